@@ -0,0 +1,258 @@
+////////////////////////////////////////////////////////////////
+//
+// Blood Pill - IMA ADPCM codec
+//
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+////////////////////////////////
+
+
+#include "bloodpill.h"
+#include "adpcmfile.h"
+
+// samples are processed in blocks: serial predictor part goes over small code buffer
+// while nibble packing/unpacking has no dependencies and is left to compiler to vectorize
+#define ADPCM_BLOCK 4096
+
+static const int imasteps[89] = 
+{
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+	19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+	50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+	130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+	337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+	876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+	2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+	5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+	15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const int imastepchanges[8] = { -1, -1, -1, -1, 2, 4, 6, 8 };
+
+typedef struct
+{
+	int last;
+	int index;
+}adpcmstate_t;
+
+/*
+==========================================================================================
+
+  IMA ADPCM
+
+==========================================================================================
+*/
+
+static inline int ADPCM_DecodeCode(adpcmstate_t *state, int code)
+{
+	int s;
+
+	s = (imasteps[state->index] * (((code & 7) << 1) | 1)) >> 3;
+	if (code & 8)
+		s = -s;
+	s += state->last;
+	if (s < -32768)
+		s = -32768;
+	else if (s > 32767)
+		s = 32767;
+	state->index += imastepchanges[code & 7];
+	if (state->index < 0)
+		state->index = 0;
+	else if (state->index > 88)
+		state->index = 88;
+	state->last = s;
+	return s;
+}
+
+static inline int ADPCM_EncodeSample(adpcmstate_t *state, int sample)
+{
+	int delta, code;
+
+	delta = sample - state->last;
+	code = 0;
+	if (delta < 0)
+	{
+		code = 8;
+		delta = -delta;
+	}
+	delta = (delta << 2) / imasteps[state->index];
+	code |= (delta > 7) ? 7 : delta;
+	// keep decoder state in sync
+	ADPCM_DecodeCode(state, code);
+	return code;
+}
+
+// decode up to ADPCM_BLOCK/2 bytes
+static void ADPCM_DecodeBlock(adpcmstate_t *state, byte *data, int n, short *samples)
+{
+	byte codes[ADPCM_BLOCK];
+	int i;
+
+	for (i = 0; i < n; i++)
+	{
+		codes[i*2] = data[i] >> 4;
+		codes[i*2 + 1] = data[i] & 15;
+	}
+	for (i = 0; i < n*2; i++)
+		samples[i] = (short)ADPCM_DecodeCode(state, codes[i]);
+}
+
+int ADPCM_Decode(byte *data, int datasize, short *samples)
+{
+	adpcmstate_t state;
+	int pos, n;
+
+	state.last = 0;
+	state.index = 0;
+	for (pos = 0; pos < datasize; pos += n)
+	{
+		n = min(ADPCM_BLOCK / 2, datasize - pos);
+		ADPCM_DecodeBlock(&state, data + pos, n, samples + pos*2);
+	}
+	return datasize * 2;
+}
+
+void ADPCM_DecodeStream(byte *data, int datasize, pcmsink_t sink, void *sinkdata)
+{
+	short samples[ADPCM_BLOCK];
+	adpcmstate_t state;
+	int pos, n;
+
+	state.last = 0;
+	state.index = 0;
+	for (pos = 0; pos < datasize; pos += n)
+	{
+		n = min(ADPCM_BLOCK / 2, datasize - pos);
+		ADPCM_DecodeBlock(&state, data + pos, n, samples);
+		sink(samples, n*2, sinkdata);
+	}
+}
+
+int ADPCM_Encode(short *samples, int numsamples, byte *data)
+{
+	byte codes[ADPCM_BLOCK];
+	adpcmstate_t state;
+	int pos, i, n;
+
+	state.last = 0;
+	state.index = 0;
+	for (pos = 0; pos < numsamples; pos += ADPCM_BLOCK)
+	{
+		n = min(ADPCM_BLOCK, numsamples - pos);
+		for (i = 0; i < n; i++)
+			codes[i] = (byte)ADPCM_EncodeSample(&state, samples[pos + i]);
+		// odd sample count, last byte gets empty low nibble
+		if (n & 1)
+			codes[n++] = 0;
+		for (i = 0; i < n / 2; i++)
+			data[pos/2 + i] = (codes[i*2] << 4) | codes[i*2 + 1];
+	}
+	return (numsamples + 1) / 2;
+}
+
+/*
+==========================================================================================
+
+  RIFF WAVE
+
+==========================================================================================
+*/
+
+byte *ADPCM_ToWAV(byte *data, int datasize, int rate, int *outsize)
+{
+	short *samples;
+	byte *wav, *out;
+	int i, numsamples;
+
+	samples = (short *)mem_alloc(datasize * 2 * sizeof(short));
+	numsamples = ADPCM_Decode(data, datasize, samples);
+
+	// 16-bit PCM mono
+	wav = (byte *)mem_alloc(WAV_HEADER_SIZE + numsamples * 2);
+	WAV_WriteHeader(wav, rate, 1, numsamples * 2);
+	out = wav + WAV_HEADER_SIZE;
+	for (i = 0; i < numsamples; i++)
+	{
+		out[i*2] = samples[i] & 0xFF;
+		out[i*2 + 1] = (samples[i] >> 8) & 0xFF;
+	}
+	mem_free(samples);
+
+	*outsize = WAV_HEADER_SIZE + numsamples * 2;
+	return wav;
+}
+
+byte *ADPCM_FromWAV(byte *wav, int wavsize, int *outsize)
+{
+	byte *chunk, *end, *fmt, *pcm, *data;
+	unsigned int chunksize, fmtsize, pcmsize;
+	int i, channels, numsamples;
+	short *samples;
+
+	if (wavsize < 12 || memcmp(wav, "RIFF", 4) || memcmp(wav + 8, "WAVE", 4))
+		return NULL;
+
+	// find format and data chunks
+	fmt = pcm = NULL;
+	fmtsize = pcmsize = 0;
+	end = wav + wavsize;
+	for (chunk = wav + 12; end - chunk >= 8; chunk += 8 + chunksize + (chunksize & 1))
+	{
+		chunksize = ReadUInt(chunk + 4);
+		if (!memcmp(chunk, "fmt ", 4) && chunksize >= 16 && chunksize <= (unsigned int)(end - chunk - 8))
+		{
+			fmt = chunk + 8;
+			fmtsize = chunksize;
+		}
+		else if (!memcmp(chunk, "data", 4))
+		{
+			pcm = chunk + 8;
+			pcmsize = min(chunksize, (unsigned int)(end - chunk - 8));
+			break;
+		}
+		if (chunksize > (unsigned int)(end - chunk - 8))
+			break;
+	}
+	if (!fmt || !pcm)
+		return NULL;
+
+	// only 16-bit PCM, extensible format is fine as long as it's PCM
+	if (ReadUShort(fmt) != 1 && !(ReadUShort(fmt) == 0xFFFE && fmtsize >= 40 && ReadUShort(fmt + 24) == 1))
+		return NULL;
+	channels = ReadUShort(fmt + 2);
+	if (ReadUShort(fmt + 14) != 16 || (channels != 1 && channels != 2))
+		return NULL;
+
+	// get mono samples
+	numsamples = pcmsize / (2 * channels);
+	samples = (short *)mem_alloc(max(numsamples, 1) * sizeof(short));
+	if (channels == 2)
+	{
+		for (i = 0; i < numsamples; i++)
+			samples[i] = (short)((ReadShort(pcm + i*4) + ReadShort(pcm + i*4 + 2)) / 2);
+	}
+	else
+	{
+		for (i = 0; i < numsamples; i++)
+			samples[i] = (short)ReadShort(pcm + i*2);
+	}
+
+	// encode
+	data = (byte *)mem_alloc(max((numsamples + 1) / 2, 1));
+	*outsize = ADPCM_Encode(samples, numsamples, data);
+	mem_free(samples);
+	return data;
+}
@@ -0,0 +1,48 @@
+////////////////////////////////////////////////////////////////
+//
+// Blood Pill - IMA ADPCM codec
+//
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+////////////////////////////////
+
+
+#ifndef __ADPCMFILE__
+#define __ADPCMFILE__
+
+#include "wavfile.h"
+
+// Blood Omen sounds are headerless mono IMA ADPCM (same as SoX '-t ima'):
+// 4 bits per sample, high nibble first, predictor starts at 0 with step index 0
+// sampling rate is not stored, it comes from adpcm.rate (klist or listfile)
+
+// decode datasize bytes into datasize*2 samples, returns number of samples
+int ADPCM_Decode(byte *data, int datasize, short *samples);
+
+// decode passing samples to sink by blocks, so whole sound is never held in memory
+void ADPCM_DecodeStream(byte *data, int datasize, pcmsink_t sink, void *sinkdata);
+
+// encode samples into (numsamples + 1)/2 bytes, returns number of bytes written
+int ADPCM_Encode(short *samples, int numsamples, byte *data);
+
+// ADPCM to 16-bit PCM RIFF WAVE, returns allocated buffer
+byte *ADPCM_ToWAV(byte *data, int datasize, int rate, int *outsize);
+
+// 16-bit PCM RIFF WAVE (mono or stereo, which gets mixed) to ADPCM
+// returns allocated buffer or NULL if WAV is not in supported format
+byte *ADPCM_FromWAV(byte *wav, int wavsize, int *outsize);
+
+#endif
@@ -26,8 +26,15 @@
 #include "soxsupp.h"
 #include "BO1.h"
 #include "filter.h"
+#include "thread.h"
 
 #include <windows.h>
+#ifdef WIN32
+#include <io.h>
+#else
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
 
 #define DEFAULT_BIGFILENAME	"pill.big"
 #define DEFAULT_PACKPATH	"bigfile"
@@ -2187,6 +2194,7 @@ bigklist_t *BigfileLoadKList(char *filename, bool loadDefault)
 	klist = (bigklist_t *)mem_alloc(sizeof(bigklist_t));
 	klist->entries = NULL;
 	klist->numentries = 0;
+	klist->hashindex = NULL;
 
 	// open file
 	if (loadDefault)
@@ -2216,6 +2224,7 @@ bigklist_t *BigfileLoadKList(char *filename, bool loadDefault)
 
 	// allocate
 	klist->entries = (bigkentry_t *)mem_alloc(linenum * sizeof(bigkentry_t));
+	klist->hashindex = NewHashIndex(linenum);
 
 	// parse klist
 	linenum = 0;
@@ -2259,10 +2268,11 @@ bigklist_t *BigfileLoadKList(char *filename, bool loadDefault)
 				entry->pathonly = false;
 				strcpy(entry->path, "");
 
-				// warn for double definition
-				for (i = 0; i < klist->numentries; i++)
-					if (klist->entries[i].hash == hash)
-						Warning("redefinition of hash %.8X on line %i", hash, linenum);
+				// warn for double definition, first definition is used
+				if (HashIndexFind(klist->hashindex, hash, NULL) >= 0)
+					Warning("redefinition of hash %.8X on line %i", hash, linenum);
+				else
+					HashIndexAdd(klist->hashindex, hash, klist->numentries);
 
 				klist->numentries++;
 			}
@@ -2331,9 +2341,9 @@ bigkentry_t *BigfileSearchKList(unsigned int hash)
 
 	if (bigklist)
 	{
-		for (i = 0; i < bigklist->numentries; i++)
-			if (bigklist->entries[i].hash == hash)
-				return &bigklist->entries[i];
+		i = HashIndexFind(bigklist->hashindex, hash, NULL);
+		if (i >= 0)
+			return &bigklist->entries[i];
 	}
 	return NULL;
 }
@@ -2343,6 +2353,8 @@ void BigfileFreeKList(bigklist_t *klist)
 	if (klist->entries)
 		mem_free(klist->entries);
 	klist->entries = NULL;
+	FreeHashIndex(klist->hashindex);
+	klist->hashindex = NULL;
 	mem_free(klist);
 }
 
@@ -2358,6 +2370,10 @@ void BigfileEmptyEntry(bigfileentry_t *entry)
 {
 	entry->data = NULL;
 	entry->adpcmrate = 11025;
+	entry->srctime = 0;
+	entry->srcsize = 0;
+	entry->srccrc = 0;
+	entry->srcparms = 0;
 	FlushRawInfo(&entry->rawinfo);
 }
 
@@ -2369,6 +2385,18 @@ void BigfileSeekFile(FILE *f, bigfileentry_t *entry)
 
 void BigfileSeekContents(FILE *f, byte *contents, bigfileentry_t *entry)
 {
+	bigfileview_t *view;
+
+	// mapped file, just copy
+	view = BigfileGetView(f);
+	if (view)
+	{
+		if ((size_t)entry->offset + entry->size > view->size)
+			Error( "error reading data on file %.8X (out of file bounds)", entry->hash);
+		memcpy(contents, view->data + entry->offset, entry->size);
+		return;
+	}
+
 	if (fseek(f, (long int)entry->offset, SEEK_SET))
 		Error( "error seeking for data on file %.8X", entry->hash);
 
@@ -2376,6 +2404,139 @@ void BigfileSeekContents(FILE *f, byte *contents, bigfileentry_t *entry)
 		Error( "error reading data on file %.8X (%s)", entry->hash, strerror(errno));
 }
 
+/*
+==========================================================================================
+
+  BigFile views
+
+  bigfile opened for reading could be mapped into memory once, so entry contents
+  are served as pointers to mapped data instead of seek-and-read for every access
+  views are read-only and could be shared between threads
+
+==========================================================================================
+*/
+
+bigfileview_t *bigfileviews = NULL;
+
+bigfileview_t *BigfileGetView(FILE *f)
+{
+	bigfileview_t *view;
+
+	for (view = bigfileviews; view; view = view->next)
+		if (view->file == f)
+			return view;
+	return NULL;
+}
+
+// map file opened as a stream, returns NULL if mapping is not possible
+// in which case all reads fall back to stream
+bigfileview_t *BigfileOpenView(FILE *f)
+{
+	bigfileview_t *view;
+	size_t size;
+	byte *data;
+#ifdef WIN32
+	HANDLE file, mapping;
+#else
+	struct stat st;
+#endif
+
+	view = BigfileGetView(f);
+	if (view)
+		return view;
+	fflush(f);
+#ifdef WIN32
+	file = (HANDLE)_get_osfhandle(_fileno(f));
+	if (file == INVALID_HANDLE_VALUE)
+		return NULL;
+	size = (size_t)GetFileSize(file, NULL);
+	if (size == (size_t)INVALID_FILE_SIZE || size == 0)
+		return NULL;
+	mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL)
+		return NULL;
+	data = (byte *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (data == NULL)
+	{
+		CloseHandle(mapping);
+		return NULL;
+	}
+#else
+	if (fstat(fileno(f), &st) || st.st_size <= 0)
+		return NULL;
+	size = (size_t)st.st_size;
+	data = (byte *)mmap(NULL, size, PROT_READ, MAP_SHARED, fileno(f), 0);
+	if (data == (byte *)MAP_FAILED)
+		return NULL;
+#endif
+	view = (bigfileview_t *)mem_alloc(sizeof(bigfileview_t));
+	memset(view, 0, sizeof(bigfileview_t));
+	view->file = f;
+	view->data = data;
+	view->size = size;
+#ifdef WIN32
+	view->mapping = mapping;
+#endif
+	view->next = bigfileviews;
+	bigfileviews = view;
+	Verbose("mapped %u bytes of bigfile\n", (unsigned int)size);
+	return view;
+}
+
+// should be called before closing the stream
+void BigfileCloseView(FILE *f)
+{
+	bigfileview_t *view, **prev;
+
+	for (prev = &bigfileviews; *prev; prev = &(*prev)->next)
+	{
+		view = *prev;
+		if (view->file != f)
+			continue;
+		*prev = view->next;
+#ifdef WIN32
+		UnmapViewOfFile(view->data);
+		CloseHandle(view->mapping);
+#else
+		munmap(view->data, view->size);
+#endif
+		mem_free(view);
+		return;
+	}
+}
+
+// get entry contents
+// returns pointer into mapped file (no copy) or allocated copy if file is not mapped
+// contents should be released with BigfileReleaseContents and never modified
+byte *BigfileGetContents(FILE *f, bigfileentry_t *entry)
+{
+	bigfileview_t *view;
+	byte *contents;
+
+	view = BigfileGetView(f);
+	if (view)
+	{
+		if ((size_t)entry->offset + entry->size > view->size)
+			Error( "error reading data on file %.8X (out of file bounds)", entry->hash);
+		return view->data + entry->offset;
+	}
+	contents = (byte *)mem_alloc(entry->size);
+	BigfileSeekContents(f, contents, entry);
+	return contents;
+}
+
+void BigfileReleaseContents(byte *contents)
+{
+	bigfileview_t *view;
+
+	if (contents == NULL)
+		return;
+	for (view = bigfileviews; view; view = view->next)
+		if (contents >= view->data && contents <= view->data + view->size)
+			return;
+	mem_free(contents);
+}
+
 void BigfileWriteListfile(FILE *f, bigfileheader_t *data)
 {
 	bigfileentry_t *entry;
@@ -2417,6 +2578,34 @@ void BigfileWriteListfile(FILE *f, bigfileheader_t *data)
 			default:
 				break;
 		}
+
+		// source files info
+		if (entry->srcsize)
+		{
+			fprintf(f, "source.time=%i\n", entry->srctime);
+			fprintf(f, "source.size=%u\n", entry->srcsize);
+			fprintf(f, "source.crc=%.8X\n", entry->srccrc);
+			fprintf(f, "source.parms=%.8X\n", entry->srcparms);
+		}
+	}
+}
+
+// indexes for internal names table, built once
+hashindex_t *csvnameindex = NULL; // lowercase name -> name
+hashindex_t *csvhashindex = NULL; // hash -> name
+
+void BigfileIndexCSVNames(void)
+{
+	int i;
+
+	if (csvnameindex)
+		return;
+	csvnameindex = NewHashIndex(NUM_CSV_ENTRIES);
+	csvhashindex = NewHashIndex(NUM_CSV_ENTRIES);
+	for (i = 0; i < NUM_CSV_ENTRIES; i++)
+	{
+		HashIndexAdd(csvnameindex, HashString(wheelofdoom_names[i].name), i);
+		HashIndexAdd(csvhashindex, wheelofdoom_names[i].hash, i);
 	}
 }
 
@@ -2424,7 +2613,7 @@ void BigfileWriteListfile(FILE *f, bigfileheader_t *data)
 unsigned int BigfileEntryHashFromString(char *string, bool casterror)
 {
 	unsigned int hash;
-	int i;
+	int i, slot;
 
 	if (string[0] == '#')
 	{
@@ -2432,12 +2621,12 @@ unsigned int BigfileEntryHashFromString(char *string, bool casterror)
 		return hash;
 	}
 	// filename or path
-	for (i = 0; i < NUM_CSV_ENTRIES; i++)
-		if (!stricmp(string, wheelofdoom_names[i].name))
-			if (strlen(string) == strlen(wheelofdoom_names[i].name))
-				break;
-	if (i < NUM_CSV_ENTRIES)
+	BigfileIndexCSVNames();
+	slot = -1;
+	while((i = HashIndexFind(csvnameindex, HashString(string), &slot)) >= 0)
 	{
+		if (stricmp(string, wheelofdoom_names[i].name))
+			continue;
 		hash = wheelofdoom_names[i].hash;
 		// Verbose("Hash filename: %.8X\n", hash);
 		return hash;
@@ -2452,12 +2641,28 @@ bigfileentry_t *BigfileGetEntry(bigfileheader_t *bigfile, unsigned int hash)
 {
 	int i;
 
+	if (bigfile->hashindex)
+	{
+		i = HashIndexFind(bigfile->hashindex, hash, NULL);
+		return (i >= 0) ? &bigfile->entries[i] : NULL;
+	}
 	for (i = 0; i < (int)bigfile->numentries; i++)
 		if (bigfile->entries[i].hash == hash)
 			return &bigfile->entries[i];
 	return NULL;
 }
 
+// (re)build hash index for header, should be called after entries are added
+void BigfileIndexHeader(bigfileheader_t *bigfile)
+{
+	int i;
+
+	FreeHashIndex(bigfile->hashindex);
+	bigfile->hashindex = NewHashIndex(bigfile->numentries);
+	for (i = 0; i < (int)bigfile->numentries; i++)
+		HashIndexAdd(bigfile->hashindex, bigfile->entries[i].hash, i);
+}
+
 // quick way to get entry data from header
 bigfileentry_t *ReadBigfileHeaderOneEntry(FILE *f, unsigned int hash)
 {
@@ -2491,14 +2696,10 @@ bigfileentry_t *ReadBigfileHeaderOneEntry(FILE *f, unsigned int hash)
 		if (!entry->hash || !entry->offset)
 			Error("BigfileHeader: entry %i is broken\n", i);
 		// assign known name
-		for (i = 0; i < NUM_CSV_ENTRIES; i++)
-		{
-			if (wheelofdoom_names[i].hash == entry->hash)
-			{
-				sprintf(entry->name, "%s%s", bigentryautopaths[BIGENTRY_UNKNOWN], wheelofdoom_names[i].name);
-				break;
-			}
-		}
+		BigfileIndexCSVNames();
+		i = HashIndexFind(csvhashindex, entry->hash, NULL);
+		if ((int)i >= 0)
+			sprintf(entry->name, "%s%s", bigentryautopaths[BIGENTRY_UNKNOWN], wheelofdoom_names[i].name);
 		break;
 	}
 
@@ -2517,6 +2718,7 @@ bigfileheader_t *ReadBigfileHeader(FILE *f, bool loadfilecontents, bool hashname
 	int i, linenum, namesloaded;
 
 	data = (bigfileheader_t *)mem_alloc(sizeof(bigfileheader_t));
+	data->hashindex = NULL;
 
 	// read header
 	fseek(f, SEEK_SET, 0);
@@ -2547,6 +2749,7 @@ bigfileheader_t *ReadBigfileHeader(FILE *f, bool loadfilecontents, bool hashname
 			Error("BigfileHeader: entry %i is broken\n", i);
 	}
 	PacifierEnd();
+	BigfileIndexHeader(data);
 
 	// load CSV list for filenames
 	if (!hashnamesonly)
@@ -2566,15 +2769,13 @@ bigfileheader_t *ReadBigfileHeader(FILE *f, bool loadfilecontents, bool hashname
 					continue;
 				}
 				// find hash
-				for (i = 0; i < (int)data->numentries; i++)
+				i = HashIndexFind(data->hashindex, hash, NULL);
+				if (i >= 0)
 				{
-					if (data->entries[i].hash != hash)
-						continue;
 					ConvSlashW2U(temp);
 					ExtractFileName(temp, line); 
-					sprintf(entry->name, "%s%s", bigentryautopaths[BIGENTRY_UNKNOWN], line);
+					sprintf(data->entries[i].name, "%s%s", bigentryautopaths[BIGENTRY_UNKNOWN], line);
 					namesloaded++;
-					break;
 				}
 			}
 			Verbose("BO1.csv: loaded %i names\n", namesloaded);
@@ -2617,15 +2818,11 @@ bigfileheader_t *ReadBigfileHeader(FILE *f, bool loadfilecontents, bool hashname
 			namesloaded = 0;
 			for (linenum = 0; linenum < NUM_CSV_ENTRIES; linenum++)
 			{
-				hash = wheelofdoom_names[linenum].hash;
-				for (i = 0; i < (int)data->numentries; i++)
-				{
-					if (data->entries[i].hash != hash)
-						continue;
-					namesloaded++;
-					sprintf(data->entries[i].name, "%s%s", bigentryautopaths[BIGENTRY_UNKNOWN], wheelofdoom_names[linenum].name);
-					break;
-				}
+				i = HashIndexFind(data->hashindex, wheelofdoom_names[linenum].hash, NULL);
+				if (i < 0)
+					continue;
+				namesloaded++;
+				sprintf(data->entries[i].name, "%s%s", bigentryautopaths[BIGENTRY_UNKNOWN], wheelofdoom_names[linenum].name);
 			}
 			if (namesloaded)
 				Verbose("loaded %i internal filenames.\n", namesloaded);
@@ -2643,8 +2840,7 @@ bigfileheader_t *ReadBigfileHeader(FILE *f, bool loadfilecontents, bool hashname
 
 			Pacifier("loading entry %i of %i...", i + 1, data->numentries);
 
-			entry->data = (byte *)mem_alloc(entry->size);
-			BigfileSeekContents(f, entry->data, entry);
+			entry->data = BigfileGetContents(f, entry);
 		}
 		PacifierEnd();
 	} 
@@ -2657,6 +2853,8 @@ void FreeBigfileHeader(bigfileheader_t *bigfile)
 	if (bigfile->entries)
 		mem_free(bigfile->entries);
 	bigfile->entries = NULL;
+	FreeHashIndex(bigfile->hashindex);
+	bigfile->hashindex = NULL;
 	mem_free(bigfile);
 }
 
@@ -2676,12 +2874,68 @@ void BigfileHeaderRecalcOffsets(bigfileheader_t *data, int additionalentries)
 	}
 }
 
+// deduplicated bigfiles have several entries pointing to same data
+typedef struct
+{
+	unsigned int offset;
+	unsigned int size;
+	int          entry;
+}bigfilespan_t;
+
+static int BigfileSpanCompare(const void *a, const void *b)
+{
+	bigfilespan_t *spana = (bigfilespan_t *)a, *spanb = (bigfilespan_t *)b;
+
+	if (spana->offset != spanb->offset)
+		return (spana->offset < spanb->offset) ? -1 : 1;
+	return spana->entry - spanb->entry;
+}
+
+// find entries which share data with others, returns bytes saved by sharing
+// shared (optional) is set for every entry that is sharing data
+int BigfileFindShared(bigfileheader_t *data, bool *shared, int *numduplicates)
+{
+	bigfilespan_t *spans;
+	int i, j, numspans, saved;
+
+	spans = (bigfilespan_t *)mem_alloc(sizeof(bigfilespan_t) * (data->numentries + 1));
+	numspans = 0;
+	for (i = 0; i < (int)data->numentries; i++)
+	{
+		if (shared)
+			shared[i] = false;
+		if (!data->entries[i].size)
+			continue;
+		spans[numspans].offset = data->entries[i].offset;
+		spans[numspans].size = data->entries[i].size;
+		spans[numspans].entry = i;
+		numspans++;
+	}
+	qsort(spans, numspans, sizeof(bigfilespan_t), BigfileSpanCompare);
+	saved = 0;
+	*numduplicates = 0;
+	for (i = 0; i < numspans; i = j)
+	{
+		for (j = i + 1; j < numspans && spans[j].offset == spans[i].offset; j++)
+		{
+			saved += spans[j].size;
+			(*numduplicates)++;
+			if (shared)
+				shared[spans[j].entry] = true;
+		}
+		if (shared && j > i + 1)
+			shared[spans[i].entry] = true;
+	}
+	mem_free(spans);
+	return saved;
+}
+
 // print stats about loaded bigfile entry
 void BigfileEmitStats(bigfileheader_t *data)
 {
 	bigfileentry_t *entry;
 	int stats[BIGFILE_NUM_FILETYPES], timstats[4], rawstats[NUM_RAW_TYPES], nullfiles;
-	int i;
+	int i, duplicates, saved;
 
 	// collect stats
 	nullfiles = 0;
@@ -2755,6 +3009,9 @@ void BigfileEmitStats(bigfileheader_t *data)
 		Print(" %6i unknown\n", stats[BIGENTRY_UNKNOWN]);
 	if (nullfiles)
 		Print(" %6i null\n", nullfiles);
+	saved = BigfileFindShared(data, NULL, &duplicates);
+	if (duplicates)
+		Print(" %6i duplicates (%i bytes saved)\n", duplicates, saved);
 	Verbose(" %6i TOTAL\n", data->numentries);
 }
 
@@ -2775,6 +3032,7 @@ bigfileheader_t *BigfileOpenListfile(char *srcdir)
 
 	// read number of entries
 	data = (bigfileheader_t *)mem_alloc(sizeof(bigfileheader_t));
+	data->hashindex = NULL;
 	if (fscanf(f, "numentries=%i\n", &numentries) != 1)
 		Error("broken numentries record");
 	Verbose("%s: %i entries\n", filename, numentries);
@@ -2839,11 +3097,21 @@ bigfileheader_t *BigfileOpenListfile(char *srcdir)
 		// for VAG
 		else if (sscanf(line, "adpcm.rate=%i", &val))
 			entry->adpcmrate = val;
+		// source files info
+		else if (sscanf(line, "source.time=%i", &val))
+			entry->srctime = val;
+		else if (sscanf(line, "source.size=%u", &uval))
+			entry->srcsize = uval;
+		else if (sscanf(line, "source.crc=%X", &uval))
+			entry->srccrc = uval;
+		else if (sscanf(line, "source.parms=%X", &uval))
+			entry->srcparms = uval;
 		// for raw
 		else if (entry->type == BIGENTRY_SPRITE)
 			ReadRawInfo(line, &entry->rawinfo);
 	}
 	PacifierEnd();
+	BigfileIndexHeader(data);
 
 	// emit some ststs
 	BigfileEmitStats(data);
@@ -2865,7 +3133,8 @@ void TGAfromTIM(FILE *bigf, bigfileentry_t *entry, char *outfile, bool bpp16to24
 	tim_image_t *tim;
 	int i;
 
-	BigfileSeekFile(bigf, entry);
+	if (entry->data == NULL)
+		BigfileSeekFile(bigf, entry);
 	for (i = 0; i < entry->timlayers; i++)
 	{
 		// extract base
@@ -2970,6 +3239,35 @@ void BigFileUnpackOriginalEntry(bigfileentry_t *entry, char *dstdir, bool place_
 
 int MapExportTGA(char *mapfile, byte *fileData, int fileDataSize, char *outfile, bigfileheader_t *bigfileheader, FILE *bigfile, char *tilespath, bool with_solid, bool with_triggers, bool with_lighting, bool show_save_id, byte toggled_objects, bool developer, int devnum, bool group_sections_by_path);
 int MapExportTXT(char *mapfile, byte *fileData, int fileDataSize, char *outfile, bigfileheader_t *bigfileheader, FILE *bigfile, char *tilespath);
+
+// when unpacking with several threads, this guards conversions which are not thread-safe
+void *unpackmutex = NULL;
+
+void BigFileUnpackLock(void)
+{
+	if (unpackmutex)
+		Thread_LockMutex(unpackmutex);
+}
+
+void BigFileUnpackUnlock(void)
+{
+	if (unpackmutex)
+		Thread_UnlockMutex(unpackmutex);
+}
+
+// write ADPCM or VAG sound to 16-bit PCM WAV while it is decoded, so memory use does not depend on sound length
+void BigfileWriteSoundWAV(bigfileentry_t *entry, char *outfile, int rate)
+{
+	wavwriter_t *wav;
+
+	wav = WAV_Create(outfile, rate, 1);
+	if (entry->type == BIGENTRY_VAG)
+		VAG_UnpackStream(entry->data, 64, entry->size, WAV_Sink, wav);
+	else
+		ADPCM_DecodeStream(entry->data, entry->size, WAV_Sink, wav);
+	WAV_Close(wav);
+}
+
 void BigFileUnpackEntry(bigfileheader_t *bigfileheader, FILE *bigf, bigfileentry_t *entry, char *dstdir, bool tim2tga, bool bpp16to24, bool nopaths, int adpcmconvert, int vagconvert, bool rawconvert, rawtype_t forcerawtype, bool rawnoalign, bool map2tga, bool map_show_contents, bool map_show_triggers, bool map_show_lighting, bool map_show_save_id, bool map_toggled_objects)
 {
 	char savefile[MAX_OSPATH], outfile[MAX_OSPATH], basename[MAX_OSPATH], path[MAX_OSPATH];
@@ -3000,10 +3298,7 @@ void BigFileUnpackEntry(bigfileheader_t *bigfileheader, FILE *bigf, bigfileentry
 
 	// load file contents
 	if (entry->data == NULL)
-	{
-		entry->data = (byte *)mem_alloc(entry->size);
-		BigfileSeekContents(bigf, entry->data, entry);
-	}
+		entry->data = BigfileGetContents(bigf, entry);
 
 	// autoextract
 	ExtractFileBase(entry->name, basename);
@@ -3029,7 +3324,13 @@ void BigFileUnpackEntry(bigfileheader_t *bigfileheader, FILE *bigf, bigfileentry
 			{
 				outsize = entry->size;
 				data = (byte *)LzDec(&size, entry->data, 0, outsize, true);
-				mem_free(entry->data);
+				if (data == NULL)
+				{
+					Warning("%s: broken tilemap, saving as is", entry->name);
+					BigFileUnpackOriginalEntry(entry, dstdir, false, false);
+					break;
+				}
+				BigfileReleaseContents(entry->data);
 				entry->timlayers = 1;
 				entry->data = data;
 				entry->size = size;
@@ -3048,11 +3349,14 @@ void BigFileUnpackEntry(bigfileheader_t *bigfileheader, FILE *bigf, bigfileentry
 			// extract map
 			if (map2tga)
 			{
+				// map renderer uses shared pics cache
+				BigFileUnpackLock();
 				oldprint = noprint;
 				noprint = true;
 				sprintf(outfile, "%s/%s%s.tga", dstdir, path, basename);
 				MapExportTGA(basename, entry->data, entry->size, outfile, bigfileheader, bigf, "", map_show_contents, map_show_triggers, map_show_lighting, map_show_save_id, map_toggled_objects, false, 0, nopaths ? false : true);
 				noprint = oldprint;
+				BigFileUnpackUnlock();
 			}
 			else
 			{
@@ -3076,7 +3380,13 @@ void BigFileUnpackEntry(bigfileheader_t *bigfileheader, FILE *bigf, bigfileentry
 					sprintf(outputcmd, "-t wav -e signed-integer");
 				else 
 					sprintf(outputcmd, "-t wav");
-				if (SoX_DataToData(data, size, "--no-dither", inputcmd, outputcmd, &outdata, &outsize, ""))
+				if (c == 2)
+				{
+					// 16-bit PCM is written while decoding
+					sprintf(entry->name, "%s.wav", basename);  // write correct listfile.txt
+					BigfileWriteSoundWAV(entry, savefile, entry->adpcmrate);
+				}
+				else if (SoX_DataToData(data, size, "--no-dither", inputcmd, outputcmd, &outdata, &outsize, ""))
 				{
 					sprintf(entry->name, (c == 3) ? "%s.ogg" : "%s.wav", basename);  // write correct listfile.txt
 					SaveFile(savefile, outdata, outsize);
@@ -3100,30 +3410,37 @@ void BigFileUnpackEntry(bigfileheader_t *bigfileheader, FILE *bigf, bigfileentry
 			if (vagconvert)
 			{
 				c = vagconvert;
-				VAG_Unpack(entry->data, 64, entry->size, &data, &size);
-				sprintf(inputcmd, "-t s16 -r %i -c 1", entry->adpcmrate);
 				// write
 				StripFileExtension(entry->name, basename);
 				sprintf(savefile, (c == 3) ? "%s/%s.ogg" : "%s/%s.wav", dstdir, basename);
-				if (c == 3)
-					sprintf(outputcmd, "-t ogg -C 7");
-				else if (c == 2)
-					sprintf(outputcmd, "-t wav -e signed-integer");
-				else 
-					sprintf(outputcmd, "-t wav");
-				if (SoX_DataToData(data, size, "--no-dither", inputcmd, outputcmd, &outdata, &outsize, ""))
+				if (c == 2)
 				{
-					sprintf(entry->name, (c == 3) ? "%s.ogg" : "%s.wav", basename);  // write correct listfile.txt
-					SaveFile(savefile, outdata, outsize);
-					mem_free(outdata);
+					// 16-bit PCM is written while decoding
+					sprintf(entry->name, "%s.wav", basename);  // write correct listfile.txt
+					BigfileWriteSoundWAV(entry, savefile, entry->adpcmrate);
 				}
 				else
 				{
-					Error("unable to convert %s, SoX Error, unpacking original", entry->name);
-					BigFileUnpackOriginalEntry(entry, dstdir, false, false);
+					VAG_Unpack(entry->data, 64, entry->size, &data, &size);
+					sprintf(inputcmd, "-t s16 -r %i -c 1", entry->adpcmrate);
+					if (c == 3)
+						sprintf(outputcmd, "-t ogg -C 7");
+					else 
+						sprintf(outputcmd, "-t wav");
+					if (SoX_DataToData(data, size, "--no-dither", inputcmd, outputcmd, &outdata, &outsize, ""))
+					{
+						sprintf(entry->name, (c == 3) ? "%s.ogg" : "%s.wav", basename);  // write correct listfile.txt
+						SaveFile(savefile, outdata, outsize);
+						mem_free(outdata);
+					}
+					else
+					{
+						Error("unable to convert %s, SoX Error, unpacking original", entry->name);
+						BigFileUnpackOriginalEntry(entry, dstdir, false, false);
+					}
+					if (data != entry->data)
+						mem_free(data);
 				}
-				if (data != entry->data)
-					mem_free(data);
 			}
 			else
 			{
@@ -3162,7 +3479,7 @@ void BigFileUnpackEntry(bigfileheader_t *bigfileheader, FILE *bigf, bigfileentry
 			BigFileUnpackOriginalEntry(entry, dstdir, false, false);
 			break;
 	}
-	mem_free(entry->data);
+	BigfileReleaseContents(entry->data);
 	entry->data = NULL;
 }
 
@@ -3174,47 +3491,49 @@ void BigFileUnpackEntry(bigfileheader_t *bigfileheader, FILE *bigf, bigfileentry
 ==========================================================================================
 */
 
-bool BigFileScanTIM(FILE *f, bigfileentry_t *entry)
+bool BigFileScanTIM(byte *data, bigfileentry_t *entry)
 {
 	tim_image_t *tim;
-	fpos_t fpos;
 	unsigned int tag;
 	unsigned int bpp;
-	int bytes;
+	int bytes, pos;
 
 	// VorteX: Blood Omen has *weird* TIM files - they could be 2 or more TIM's in one file
 	// they could be easily detected however, as second TIM goes right after base TIM 
 
-	BigfileSeekFile(f, entry);
-
 	bytes = 0;
+	pos = 0;
 	entry->timlayers = 0;
 	while(1)
 	{
-		fgetpos(f, &fpos);
-
 		// 0x10 should be at beginning of standart TIM
-		if (fread(&tag, sizeof(unsigned int), 1, f) < 1)
+		if (pos + 4 > (int)entry->size)
 			return (entry->timlayers != 0) ? true : false;
+		tag = ReadUInt(data + pos);
 		if (tag != 0x10)
 			return (entry->timlayers != 0) ? true : false;
 
 		// second uint is BPP
 		// todo: there are files with TIM header but with nasty BPP
-		if (fread(&bpp, sizeof(unsigned int), 1, f) < 1)
+		if (pos + 8 > (int)entry->size)
 			return (entry->timlayers != 0) ? true : false;
+		bpp = ReadUInt(data + pos + 4);
 		if (bpp != TIM_4Bit && bpp != TIM_8Bit && bpp != TIM_16Bit && bpp != TIM_24Bit) 
 			return (entry->timlayers != 0) ? true : false;
 
 		// try load that TIM
-		fsetpos(f, &fpos);
-		tim = TIM_LoadFromStream(f);
+		tim = TIM_LoadFromBuffer(data + pos, entry->size - pos);
 		if (tim->error)
 		{
 			FreeTIM(tim);
 			return false;
 		}
 		bytes += tim->filelen;
+		// next layer goes right after actual data (CLUT size could differ from filelen's one)
+		if (tim->CLUT)
+			pos += 20 + ReadUInt(data + pos + 8) + tim->pixelbytes;
+		else
+			pos += 20 + tim->pixelbytes;
 
 		// fill diminfo section
 		if (entry->timlayers >= (MAX_TIM_MASKS + 1))
@@ -3233,47 +3552,35 @@ bool BigFileScanTIM(FILE *f, bigfileentry_t *entry)
 	return true;
 }
 
-bool BigFileScanRiffWave(FILE *f, bigfileentry_t *entry)
+bool BigFileScanRiffWave(byte *data, bigfileentry_t *entry)
 {
-	byte tag[4];
-
-	BigfileSeekFile(f, entry);
-
 	// first unsigned int - tag
-	if (fread(&tag, sizeof(char), 4, f) < 1)
+	if (entry->size < 4)
 		return false;
-	if (tag[0] != 0x52 || tag[1] != 0x49 || tag[2] != 0x46 || tag[3] != 0x46)
+	if (data[0] != 0x52 || data[1] != 0x49 || data[2] != 0x46 || data[3] != 0x46)
 		return false;
 
 	// it's a RIFF
 	return true;
 }
 
-bool BigFileScanVAG(FILE *f, bigfileentry_t *entry)
+bool BigFileScanVAG(byte *data, bigfileentry_t *entry)
 {
-	byte tag[4];
-
-	BigfileSeekFile(f, entry);
-
 	// first unsigned int - tag
-	if (fread(&tag, sizeof(char), 4, f) < 1)
+	if (entry->size < 4)
 		return false;
-	if (tag[0] != 'V' || tag[1] != 'A' || tag[2] != 'G' || tag[3] != 'p')
+	if (data[0] != 'V' || data[1] != 'A' || data[2] != 'G' || data[3] != 'p')
 		return false;
 	return true;
 }
 
 // extensive scan for headerless VAG (by parsing file)
-bool BigFileScanVAG_PS1(FILE *f, bigfileentry_t *entry)
+bool BigFileScanVAG_PS1(byte *data, bigfileentry_t *entry)
 {
 	unsigned int readpos;
 	bool fq;
-	byte *data;
 
-	data = (byte *)mem_alloc(entry->size);
-	BigfileSeekContents(f, data, entry);
 	readpos = VAG_UnpackTest(data, entry->size, 64);
-	mem_free(data);
 	//if (readpos == entry->size)
 	//printf("%.8X______________\n", entry->hash);
 	//printf("%s: readpos vs entry size %i %i\n", entry->name, readpos, entry->size);
@@ -3283,78 +3590,64 @@ bool BigFileScanVAG_PS1(FILE *f, bigfileentry_t *entry)
 	return fq;
 }
 
-bool BigFileScanRaw(FILE *f, bigfileentry_t *entry, rawtype_t forcerawtype)
+bool BigFileScanRaw(byte *data, bigfileentry_t *entry, rawtype_t forcerawtype)
 {
-	byte *filedata;
-	rawblock_t *rawblock;
-
-	// load file contents
-	BigfileSeekFile(f, entry);
-	filedata = (byte *)mem_alloc(entry->size);
-	if (fread(filedata, entry->size, 1, f) < 1)
-	{
-		mem_free(filedata);
-		return false;
-	}
-
 	// check all raw types
-	rawblock = RawExtract(filedata, entry->size, &entry->rawinfo, true, false, forcerawtype);
-	if (rawblock->errorcode >= 0)
-	{
-		FreeRawBlock(rawblock);
-		mem_free(filedata);
+	if (RawExtractTest(data, entry->size, &entry->rawinfo, forcerawtype) >= 0)
 		return true;
-	}
 	// not found
-	FreeRawBlock(rawblock);
-	mem_free(filedata);
 	return false;
 }
 
-bigentrytype_t BigFileScanMapOrTile(FILE *f, bigfileentry_t *entry)
+bigentrytype_t BigFileScanMapOrTile(byte *data, bigfileentry_t *entry)
 {
-	byte *filedata;
 	int m;
 
-	// load file
-	BigfileSeekFile(f, entry);
-	filedata = (byte *)mem_alloc(entry->size);
-	if (fread(filedata, entry->size, 1, f) < 1)
-	{
-		mem_free(filedata);
-		return BIGENTRY_UNKNOWN;
-	}
 	// scan and return
-	m = MapScan(filedata, entry->size);
-	mem_free(filedata);
+	m = MapScan(data, entry->size);
 	return m == 1 ? BIGENTRY_MAP : (m == 2) ? BIGENTRY_TILEMAP : BIGENTRY_UNKNOWN;
 }
 
+// detect filetype from loaded entry contents
+// only touches given entry, so could be run for several entries at once
+bigentrytype_t BigfileDetectFiletypeData(byte *data, bigfileentry_t *entry, bool scanraw, rawtype_t forcerawtype)
+{
+	bigentrytype_t type;
+
+	if (BigFileScanTIM(data, entry))
+		type = BIGENTRY_TIM;
+	else if (BigFileScanRiffWave(data, entry))
+		type = BIGENTRY_RIFF_WAVE;
+	else if (BigFileScanVAG(data, entry))
+		type = BIGENTRY_VAG;
+	else if (scanraw && BigFileScanRaw(data, entry, forcerawtype))
+		type = BIGENTRY_SPRITE;
+	else if (BigFileScanVAG_PS1(data, entry))
+		type = BIGENTRY_VAG;
+	else
+		type = BigFileScanMapOrTile(data, entry);
+	return type;
+}
+
 bigentrytype_t BigfileDetectFiletype(FILE *f, bigfileentry_t *entry, bool scanraw, rawtype_t forcerawtype)
 {
-	if (BigFileScanTIM(f, entry))
-		return BIGENTRY_TIM;
-	if (BigFileScanRiffWave(f, entry))
-		return BIGENTRY_RIFF_WAVE;
-	if (BigFileScanVAG(f, entry))
-		return BIGENTRY_VAG;
-	if (scanraw)
-		if (BigFileScanRaw(f, entry, forcerawtype))
-			return BIGENTRY_SPRITE;
-	if (BigFileScanVAG_PS1(f, entry))
-		return BIGENTRY_VAG;
-	return BigFileScanMapOrTile(f, entry);
+	bigentrytype_t type;
+	byte *data;
+
+	// entry contents are fetched once and shared by all scanners
+	data = BigfileGetContents(f, entry);
+	type = BigfileDetectFiletypeData(data, entry, scanraw, forcerawtype);
+	BigfileReleaseContents(data);
+	return type;
 }
 
-void BigfileScanFiletype(FILE *f, bigfileentry_t *entry, bool scanraw, rawtype_t forcerawtype, bool allow_auto_naming)
+// apply detected filetype, klist info and automatic naming to entry
+void BigfileSetFiletype(bigfileentry_t *entry, bigentrytype_t autotype, bool allow_auto_naming)
 {
 	char name[MAX_OSPATH], ext[MAX_OSPATH];
-	bigentrytype_t autotype;
 	bigkentry_t *kentry;
 	char *autopath;
 
-	// detect filetype automatically
-	autotype = BigfileDetectFiletype(f, entry, scanraw, forcerawtype);
 	if (autotype != BIGENTRY_UNKNOWN) 
 	{
 		entry->type = autotype;
@@ -3431,101 +3724,411 @@ void BigfileScanFiletype(FILE *f, bigfileentry_t *entry, bool scanraw, rawtype_t
 	}
 }
 
-void BigfileScanFiletypes(FILE *f, bigfileheader_t *data, bool scanraw, list_t *ixlist, rawtype_t forcerawtype)
+void BigfileScanFiletype(FILE *f, bigfileentry_t *entry, bool scanraw, rawtype_t forcerawtype, bool allow_auto_naming)
 {
-	fpos_t fpos;
-	bigfileentry_t *entry;
-	int i;
-	
-	fgetpos(f, &fpos);
-	// scan for filetypes
-	for (i = 0; i < (int)data->numentries; i++)
-	{
-		entry = &data->entries[i];
-
-		// ignore if mismatched
-		if (ixlist)
-			if (!MatchIXList(entry, ixlist, false, false))
-				continue;
-		// ignore null-sized
-		if (!entry->size)
-			continue;
-		Pacifier("scanning type for entry %i of %i...", i + 1, data->numentries);
-		BigfileScanFiletype(f, entry, scanraw, forcerawtype, /*data->namesfromcsv ? false : */true);
-	}
-	fsetpos(f, &fpos);
-	
-	PacifierEnd();
-
-	// emit some stats
-	BigfileEmitStats(data);
+	BigfileSetFiletype(entry, BigfileDetectFiletype(f, entry, scanraw, forcerawtype), allow_auto_naming);
 }
 
-
 /*
 ==========================================================================================
 
-  BigFile analyser
+  BigFile detection cache
+
+  results of filetype detection are saved to <bigfile>.cache and reused
+  while bigfile size, modification time and header table are the same
 
 ==========================================================================================
 */
 
+#define BIGFILE_CACHE_IDENT   "BPDC"
+#define BIGFILE_CACHE_VERSION 2
+
+// bump whenever filetype detection changes its results, so older caches are rescanned
+// 2: impossible raw types are skipped before trial extraction, 788 byte header for type 1
+#define BIGFILE_DETECTOR_VERSION 2
+
+bool usedetectcache = true;
+
 typedef struct
 {
-	unsigned int data;
-	int occurrences;
-}
-bigchunk4_t;
+	char         ident[4];
+	int          version;
+	int          detectorversion;
+	int          entrysize;  // sizeof(bigfilecacheentry_t), guards against struct changes
+	unsigned int filesize;
+	int          filetime;
+	unsigned int headercrc;  // crc32 of bigfile header table
+	int          numentries;
+}bigfilecacheheader_t;
 
 typedef struct
 {
-	unsigned int data;
-	int occurrences;
-}
-bigchunk8_t;
+	unsigned int   hash;
+	int            type;      // detected bigentrytype_t, -1 if entry was not scanned
+	int            timlayers;
+	unsigned int   timtype[1 + MAX_TIM_MASKS];
+	short          timypos[1 + MAX_TIM_MASKS];
+	short          timxpos[1 + MAX_TIM_MASKS];
+	rawinfo_t      rawinfo;
+}bigfilecacheentry_t;
 
 typedef struct
 {
-	// unsigned int chunks
-	bigchunk4_t chunks4[2048];
-	byte chunk4;
-	int numchunks4;
-}
-bigchunkstats_t;
-
-/*
-==========================================================================================
-
-  -bigfile -list [-to]
-
-  lists bigfile contents
-
-==========================================================================================
-*/
-
-int BigFile_List(int argc, char **argv)
+	char                  filename[MAX_OSPATH];
+	bigfilecacheheader_t  header;
+	bigfilecacheentry_t  *entries;
+	bool                  changed;
+}bigfilecache_t;
+
+// fill cache header with bigfile fingerprint and set entry hashes from header table
+bool BigfileCacheFingerprint(FILE *f, bigfilecache_t *cache)
 {
-	FILE *f, *f2;
-	bigfileheader_t *data;
-	bigfileentry_t *entry;
-	char name[MAX_OSPATH], listfile[MAX_OSPATH], exportcsv[MAX_OSPATH], typestr[128], extrainfo[128];
-	bool hashnamesonly;
-	int i;
+	bigfilecacheheader_t *header;
+	bigfileview_t *view;
+	unsigned int numentries, tablesize, i;
+	fpos_t fpos;
+	byte *table;
+
+	header = &cache->header;
+	memset(header, 0, sizeof(bigfilecacheheader_t));
+	memcpy(header->ident, BIGFILE_CACHE_IDENT, 4);
+	header->version = BIGFILE_CACHE_VERSION;
+	header->detectorversion = BIGFILE_DETECTOR_VERSION;
+	header->entrysize = sizeof(bigfilecacheentry_t);
+	header->filetime = FileTime(bigfile);
+	if (header->filetime == -1)
+		return false;
 
-	// check parms
-	strcpy(exportcsv, "-");
-	strcpy(listfile, "-");
-	hashnamesonly = false;
-	if (argc > 0) 
+	// get header table
+	view = BigfileGetView(f);
+	if (view)
 	{
-		strcpy(listfile, argv[0]);
-		for (i = 0; i < argc; i++)
+		header->filesize = (unsigned int)view->size;
+		if (view->size < 4)
+			return false;
+		numentries = ReadUInt(view->data);
+		tablesize = 4 + numentries * 12;
+		if (numentries > 3000 || tablesize > view->size)
+			return false;
+		table = view->data;
+	}
+	else
+	{
+		fgetpos(f, &fpos);
+		header->filesize = (unsigned int)Q_filelength(f);
+		fseek(f, 0, SEEK_SET);
+		if (fread(&numentries, sizeof(unsigned int), 1, f) < 1 || numentries > 3000)
 		{
-			if (!strcmp(argv[i], "-exportcsv"))
-			{
-				i++; 
-				if (i < argc)
-				{
+			fsetpos(f, &fpos);
+			return false;
+		}
+		tablesize = 4 + numentries * 12;
+		table = (byte *)mem_alloc(tablesize);
+		fseek(f, 0, SEEK_SET);
+		if (fread(table, tablesize, 1, f) < 1)
+		{
+			mem_free(table);
+			fsetpos(f, &fpos);
+			return false;
+		}
+		fsetpos(f, &fpos);
+	}
+	header->headercrc = crc32(table, tablesize);
+	header->numentries = (int)numentries;
+	cache->entries = (bigfilecacheentry_t *)mem_alloc(sizeof(bigfilecacheentry_t) * (numentries + 1));
+	for (i = 0; i < numentries; i++)
+	{
+		cache->entries[i].hash = ReadUInt(table + 4 + i * 12);
+		cache->entries[i].type = -1;
+	}
+	if (!view)
+		mem_free(table);
+	return true;
+}
+
+// open cache for bigfile, return NULL if caching is not possible
+bigfilecache_t *BigfileOpenCache(FILE *f)
+{
+	bigfilecacheheader_t header;
+	bigfilecache_t *cache;
+	FILE *cf;
+	int i;
+
+	if (!usedetectcache)
+		return NULL;
+	cache = (bigfilecache_t *)mem_alloc(sizeof(bigfilecache_t));
+	if (!BigfileCacheFingerprint(f, cache))
+	{
+		mem_free(cache);
+		return NULL;
+	}
+	sprintf(cache->filename, "%s.cache", bigfile);
+	cache->changed = false;
+
+	// load saved results if they are for same bigfile
+	cf = fopen(cache->filename, "rb");
+	if (cf)
+	{
+		if (fread(&header, sizeof(header), 1, cf) == 1 && !memcmp(&header, &cache->header, sizeof(header)))
+		{
+			if (fread(cache->entries, sizeof(bigfilecacheentry_t), cache->header.numentries, cf) == (size_t)cache->header.numentries)
+				Verbose("Using detection cache %s\n", cache->filename);
+			else
+			{
+				for (i = 0; i < cache->header.numentries; i++)
+					cache->entries[i].type = -1;
+			}
+		}
+		else
+			Verbose("Detection cache %s is outdated\n", cache->filename);
+		fclose(cf);
+	}
+	return cache;
+}
+
+// get entry index in cache, -1 if not found
+int BigfileCacheFind(bigfilecache_t *cache, unsigned int hash)
+{
+	int i;
+
+	if (!cache)
+		return -1;
+	for (i = 0; i < cache->header.numentries; i++)
+		if (cache->entries[i].hash == hash)
+			return i;
+	return -1;
+}
+
+// apply cached detection results to entry, num is entry index or -1 to search by hash
+// returns false if entry is not in cache
+bool BigfileCacheGet(bigfilecache_t *cache, int num, bigfileentry_t *entry, bigentrytype_t *type)
+{
+	bigfilecacheentry_t *ce;
+
+	if (!cache)
+		return false;
+	if (num < 0)
+		num = BigfileCacheFind(cache, entry->hash);
+	if (num < 0 || num >= cache->header.numentries)
+		return false;
+	ce = &cache->entries[num];
+	if (ce->type < 0 || ce->hash != entry->hash)
+		return false;
+	entry->timlayers = ce->timlayers;
+	memcpy(entry->timtype, ce->timtype, sizeof(entry->timtype));
+	memcpy(entry->timypos, ce->timypos, sizeof(entry->timypos));
+	memcpy(entry->timxpos, ce->timxpos, sizeof(entry->timxpos));
+	memcpy(&entry->rawinfo, &ce->rawinfo, sizeof(rawinfo_t));
+	*type = (bigentrytype_t)ce->type;
+	return true;
+}
+
+// store detection results, should be called right after detection
+// different entries could be stored from several threads at once
+void BigfileCachePut(bigfilecache_t *cache, int num, bigfileentry_t *entry, bigentrytype_t type)
+{
+	bigfilecacheentry_t *ce;
+
+	if (!cache || num < 0 || num >= cache->header.numentries)
+		return;
+	ce = &cache->entries[num];
+	ce->hash = entry->hash;
+	ce->type = (int)type;
+	ce->timlayers = entry->timlayers;
+	memcpy(ce->timtype, entry->timtype, sizeof(ce->timtype));
+	memcpy(ce->timypos, entry->timypos, sizeof(ce->timypos));
+	memcpy(ce->timxpos, entry->timxpos, sizeof(ce->timxpos));
+	memcpy(&ce->rawinfo, &entry->rawinfo, sizeof(rawinfo_t));
+	cache->changed = true;
+}
+
+// save cache if anything new was detected and free it
+void BigfileCloseCache(bigfilecache_t *cache)
+{
+	FILE *cf;
+
+	if (!cache)
+		return;
+	if (cache->changed)
+	{
+		// cache is optional, not being able to write it is not an error
+		cf = fopen(cache->filename, "wb");
+		if (cf)
+		{
+			fwrite(&cache->header, sizeof(bigfilecacheheader_t), 1, cf);
+			fwrite(cache->entries, sizeof(bigfilecacheentry_t), cache->header.numentries, cf);
+			fclose(cf);
+		}
+		else
+			Verbose("Cannot write detection cache %s\n", cache->filename);
+	}
+	mem_free(cache->entries);
+	mem_free(cache);
+}
+
+typedef struct
+{
+	FILE            *f;
+	bigfileheader_t *data;
+	bool             scanraw;
+	list_t          *ixlist;
+	rawtype_t        forcerawtype;
+	int             *types; // -1 if entry is not scanned
+	bigfilecache_t  *cache;
+	void            *readmutex;
+	volatile int     scanned;
+}scanjobs_t;
+
+// detect type of single entry, called by worker threads
+void BigfileScanFiletypesJob(int i, void *parm)
+{
+	bigfileentry_t *entry;
+	bigentrytype_t type;
+	scanjobs_t *jobs;
+	byte *contents;
+	int n;
+
+	jobs = (scanjobs_t *)parm;
+	entry = &jobs->data->entries[i];
+	jobs->types[i] = -1;
+
+	// ignore if mismatched
+	if (jobs->ixlist)
+		if (!MatchIXList(entry, jobs->ixlist, false, false))
+			return;
+	// ignore null-sized
+	if (!entry->size)
+		return;
+	n = Thread_AtomicIncrement(&jobs->scanned);
+	Pacifier("scanning type for entry %i of %i...", n, jobs->data->numentries);
+
+	// already detected on previous run
+	if (BigfileCacheGet(jobs->cache, i, entry, &type))
+	{
+		jobs->types[i] = (int)type;
+		return;
+	}
+
+	// read entry once, without view file stream is shared and should be locked
+	if (jobs->readmutex)
+		Thread_LockMutex(jobs->readmutex);
+	contents = BigfileGetContents(jobs->f, entry);
+	if (jobs->readmutex)
+		Thread_UnlockMutex(jobs->readmutex);
+	type = BigfileDetectFiletypeData(contents, entry, jobs->scanraw, jobs->forcerawtype);
+	BigfileReleaseContents(contents);
+	BigfileCachePut(jobs->cache, i, entry, type);
+	jobs->types[i] = (int)type;
+}
+
+void BigfileScanFiletypes(FILE *f, bigfileheader_t *data, bool scanraw, list_t *ixlist, rawtype_t forcerawtype)
+{
+	scanjobs_t jobs;
+	fpos_t fpos;
+	int i, trials, skipped;
+	
+	fgetpos(f, &fpos);
+	// scan for filetypes
+	// detection is spread between worker threads, each one fills only it's own entry
+	// so result does not depend on job order; naming is applied afterwards in entry order
+	jobs.f = f;
+	jobs.data = data;
+	jobs.scanraw = scanraw;
+	jobs.ixlist = ixlist;
+	jobs.forcerawtype = forcerawtype;
+	jobs.types = (int *)mem_alloc(sizeof(int) * (data->numentries + 1));
+	jobs.readmutex = NULL;
+	jobs.scanned = 0;
+	// cached results are only valid for default detection
+	jobs.cache = NULL;
+	if (scanraw && forcerawtype == RAW_TYPE_UNKNOWN)
+		jobs.cache = BigfileOpenCache(f);
+	if (numthreads > 1 && !BigfileGetView(f))
+		jobs.readmutex = Thread_CreateMutex();
+	RawExtractStats(NULL, NULL, true);
+	Thread_RunJobs(data->numentries, BigfileScanFiletypesJob, &jobs);
+	Thread_DestroyMutex(jobs.readmutex);
+	BigfileCloseCache(jobs.cache);
+	for (i = 0; i < (int)data->numentries; i++)
+		if (jobs.types[i] >= 0)
+			BigfileSetFiletype(&data->entries[i], (bigentrytype_t)jobs.types[i], /*data->namesfromcsv ? false : */true);
+	mem_free(jobs.types);
+	fsetpos(f, &fpos);
+	
+	PacifierEnd();
+
+	// emit some stats
+	BigfileEmitStats(data);
+	RawExtractStats(&trials, &skipped, false);
+	if (trials || skipped)
+		Verbose(" %6i raw trials, %i skipped by signature\n", trials, skipped);
+}
+
+
+/*
+==========================================================================================
+
+  BigFile analyser
+
+==========================================================================================
+*/
+
+typedef struct
+{
+	unsigned int data;
+	int occurrences;
+}
+bigchunk4_t;
+
+typedef struct
+{
+	unsigned int data;
+	int occurrences;
+}
+bigchunk8_t;
+
+typedef struct
+{
+	// unsigned int chunks
+	bigchunk4_t chunks4[2048];
+	byte chunk4;
+	int numchunks4;
+}
+bigchunkstats_t;
+
+/*
+==========================================================================================
+
+  -bigfile -list [-to]
+
+  lists bigfile contents
+
+==========================================================================================
+*/
+
+int BigFile_List(int argc, char **argv)
+{
+	FILE *f, *f2;
+	bigfileheader_t *data;
+	bigfileentry_t *entry;
+	char name[MAX_OSPATH], listfile[MAX_OSPATH], exportcsv[MAX_OSPATH], typestr[128], extrainfo[128];
+	bool hashnamesonly;
+	int i;
+
+	// check parms
+	strcpy(exportcsv, "-");
+	strcpy(listfile, "-");
+	hashnamesonly = false;
+	if (argc > 0) 
+	{
+		strcpy(listfile, argv[0]);
+		for (i = 0; i < argc; i++)
+		{
+			if (!strcmp(argv[i], "-exportcsv"))
+			{
+				i++;
+				if (i < argc)
+				{
 					strlcpy(exportcsv, argv[i], sizeof(exportcsv));
 					Verbose("Option: export CSV file '%s'\n", argv[i]);
 				}
@@ -3544,6 +4147,7 @@ int BigFile_List(int argc, char **argv)
 
 	// open file & load header
 	f = SafeOpen(bigfile, "rb");
+	BigfileOpenView(f);
 	data = ReadBigfileHeader(f, false, hashnamesonly);
 	BigfileScanFiletypes(f, data, true, NULL, RAW_TYPE_UNKNOWN);
 
@@ -3592,6 +4196,7 @@ int BigFile_List(int argc, char **argv)
 
 	Print("done.\n");
 	FreeBigfileHeader(data);
+	BigfileCloseView(f);
 	fclose (f);
 	return 0;
 }
@@ -4085,16 +4690,15 @@ void BigFile_ExtractRawImage(int argc, char **argv, char *outfile, bigfileentry_
 		FreeList(mergelist);
 }
 
-void BigFile_ExtractSound(int argc, char **argv, char *outfile, bigfileentry_t *entry, char *infileformat, int defaultinputrate, char *format)
+// VAG entries are passed as is, they are decoded here
+// returns false if SoX is not found or failed
+bool BigFile_ExtractSound(int argc, char **argv, char *outfile, bigfileentry_t *entry, char *infileformat, int defaultinputrate, char *format)
 {
 	char informat[1024], outformat[1024], effects[1024], temp[1024];
-	byte *outdata;
-	int i, ir;
+	byte *data, *outdata;
+	int i, ir, size;
 	int outsize;
 
-	if (!soxfound)
-		Error("SoX not found!");
-
 	// additional parms
 	ir = defaultinputrate;
 	strcpy(effects, "");
@@ -4225,8 +4829,6 @@ void BigFile_ExtractSound(int argc, char **argv, char *outfile, bigfileentry_t *
 			}
 			continue;
 		}
-		// add to effect
-		sprintf(effects, "%s %s", temp, argv[i]);
 	}
 
 	// get format
@@ -4248,18 +4850,50 @@ void BigFile_ExtractSound(int argc, char **argv, char *outfile, bigfileentry_t *
 		sprintf(informat, "%s -r %i", temp, ir);
 	}
 
+	// ADPCM or VAG to 16-bit PCM WAV without effects is written while decoding
+	if ((entry->type == BIGENTRY_RAW_ADPCM || entry->type == BIGENTRY_VAG) && !stricmp(format, "wav") && !effects[0])
+	{
+		BigfileWriteSoundWAV(entry, outfile, ir ? ir : 11025);
+		Print("done.\n");
+		return true;
+	}
+
+	// VAG goes to SoX as 16-bit PCM
+	data = entry->data;
+	size = entry->size;
+	if (entry->type == BIGENTRY_VAG)
+		VAG_Unpack(entry->data, 64, entry->size, &data, &size);
+
+	// plain ADPCM to PCM WAV is done by builtin codec
+	if (!soxfound && !SoX_Native("--no-dither", informat, outformat, effects))
+	{
+		Warning("SoX not found, %s not extracted", outfile);
+		if (data != entry->data)
+			mem_free(data);
+		return false;
+	}
+
 	// run SoX
-	if (!SoX_DataToData(entry->data, entry->size, "--no-dither", informat, outformat, &outdata, &outsize, effects))
-		Error("SoX error\n");
+	if (!SoX_DataToData(data, size, "--no-dither", informat, outformat, &outdata, &outsize, effects))
+	{
+		Warning("SoX error, %s not extracted", outfile);
+		if (data != entry->data)
+			mem_free(data);
+		return false;
+	}
 	SaveFile(outfile, outdata, outsize);
 	mem_free(outdata);
+	if (data != entry->data)
+		mem_free(data);
 	Print("done.\n");
+	return true;
 }
 
-void BigFile_ExtractEntry(int argc, char **argv, FILE *bigfile, bigfileentry_t *entry, char *outfile)
+// returns false if sound conversion failed, other failures are fatal
+bool BigFile_ExtractEntry(int argc, char **argv, FILE *bigfile, bigfileentry_t *entry, char *outfile)
 {
 	char filename[MAX_OSPATH], basename[MAX_OSPATH], format[512], last;
-	bool with_solid, with_triggers, with_lighting, show_save_id, toggled_objects, bpp16to24, timscaleastilemap, timscalecustom;
+	bool ok, with_solid, with_triggers, with_lighting, show_save_id, toggled_objects, bpp16to24, timscaleastilemap, timscalecustom;
 	imgfilter_t timscaler;
 	bigfileheader_t *bigfileheader;
 	rawblock_t *rawblock;
@@ -4429,13 +5063,12 @@ void BigFile_ExtractEntry(int argc, char **argv, FILE *bigfile, bigfileentry_t *
 	if (!stricmp(format, "raw"))
 	{
 		// load file contents
-		entry->data = (byte *)mem_alloc(entry->size);
-		BigfileSeekContents(bigfile, entry->data, entry);
+		entry->data = BigfileGetContents(bigfile, entry);
 		// save file
 		SaveFile(outfile, entry->data, entry->size);
-		mem_free(entry->data);
+		BigfileReleaseContents(entry->data);
 		entry->data = NULL;
-		return;
+		return true;
 	}
 
 	// get outfile
@@ -4454,6 +5087,7 @@ void BigFile_ExtractEntry(int argc, char **argv, FILE *bigfile, bigfileentry_t *
 	}
 
 	// extract
+	ok = true;
 	switch(entry->type)
 	{
 		case BIGENTRY_UNKNOWN:
@@ -4495,73 +5129,63 @@ void BigFile_ExtractEntry(int argc, char **argv, FILE *bigfile, bigfileentry_t *
 			break;
 		case BIGENTRY_RAW_ADPCM:
 			// load file contents
-			entry->data = (byte *)mem_alloc(entry->size);
-			BigfileSeekContents(bigfile, entry->data, entry);
+			entry->data = BigfileGetContents(bigfile, entry);
 			// process
 			if (!stricmp(format, "wav") || !format[0])
 			{
 				DefaultExtension(filename, ".wav", sizeof(filename));
-				BigFile_ExtractSound(argc, argv, outfile, entry, "-t ima -c 1", 11025, "wav");
+				ok = BigFile_ExtractSound(argc, argv, outfile, entry, "-t ima -c 1", 11025, "wav");
 			}
 			else if (!stricmp(format, "ogg"))
 			{
 				DefaultExtension(filename, ".ogg", sizeof(filename));
-				BigFile_ExtractSound(argc, argv, outfile, entry, "-t ima -c 1", 11025, "ogg");
+				ok = BigFile_ExtractSound(argc, argv, outfile, entry, "-t ima -c 1", 11025, "ogg");
 			}
 			else Error("unknown format '%s'\n", format);
 			// close
-			mem_free(entry->data);
+			BigfileReleaseContents(entry->data);
 			entry->data = NULL;
 			break;
 		case BIGENTRY_RIFF_WAVE:
 			// load file contents
-			entry->data = (byte *)mem_alloc(entry->size);
-			BigfileSeekContents(bigfile, entry->data, entry);
+			entry->data = BigfileGetContents(bigfile, entry);
 			// process
 			if (!stricmp(format, "wav") || !format[0])
 			{
 				DefaultExtension(filename, ".wav", sizeof(filename));
-				BigFile_ExtractSound(argc, argv, outfile, entry, "", 0, "wav");
+				ok = BigFile_ExtractSound(argc, argv, outfile, entry, "", 0, "wav");
 			}
 			else if (!stricmp(format, "ogg"))
 			{
 				DefaultExtension(filename, ".ogg", sizeof(filename));
-				BigFile_ExtractSound(argc, argv, outfile, entry, "", 0, "ogg");
+				ok = BigFile_ExtractSound(argc, argv, outfile, entry, "", 0, "ogg");
 			}
 			else Error("unknown format '%s'\n", format);
 			// close
-			mem_free(entry->data);
+			BigfileReleaseContents(entry->data);
 			entry->data = NULL;
 			break;
 		case BIGENTRY_VAG:
-			// load file contents
-			entry->data = (byte *)mem_alloc(entry->size);
-			BigfileSeekContents(bigfile, entry->data, entry);
-			// unpack vag
-			VAG_Unpack(entry->data, 64, entry->size, &data, &size);
-			mem_free(entry->data);
-			entry->data = data;
-			entry->size = size;
-			// extract as normal sound then
+			// load file contents, BigFile_ExtractSound unpacks it
+			entry->data = BigfileGetContents(bigfile, entry);
 			if (!stricmp(format, "wav") || !format[0])	
 			{
 				DefaultExtension(filename, ".wav", sizeof(filename));
-				BigFile_ExtractSound(argc, argv, outfile, entry, "-t s16 -c 1", 11025, "wav");
+				ok = BigFile_ExtractSound(argc, argv, outfile, entry, "-t s16 -c 1", 11025, "wav");
 			}
 			else if (!stricmp(format, "ogg"))
 			{
 				DefaultExtension(filename, ".ogg", sizeof(filename));
-				BigFile_ExtractSound(argc, argv, outfile, entry, "-t s16 -c 1", 11025, "ogg");
+				ok = BigFile_ExtractSound(argc, argv, outfile, entry, "-t s16 -c 1", 11025, "ogg");
 			}
 			else Error("unknown format '%s'\n", format);
 			// close
-			mem_free(entry->data);
+			BigfileReleaseContents(entry->data);
 			entry->data = NULL;
 			break;
 		case BIGENTRY_SPRITE:
 			// read file contents and convert to rawblock, then pass to extraction func
-			entry->data = (byte *)mem_alloc(entry->size);
-			BigfileSeekContents(bigfile, entry->data, entry);
+			entry->data = BigfileGetContents(bigfile, entry);
 			rawblock = RawExtract(entry->data, entry->size, &entry->rawinfo, false, false, RAW_TYPE_UNKNOWN);
 			if (rawblock)
 			{
@@ -4584,13 +5208,12 @@ void BigFile_ExtractEntry(int argc, char **argv, FILE *bigfile, bigfileentry_t *
 			}
 			else Error("ExtractSprite: unknown format '%s'\n", format);
 			FreeRawBlock(rawblock);
-			mem_free(entry->data);
+			BigfileReleaseContents(entry->data);
 			entry->data = NULL;
 			break;
 		case BIGENTRY_TILEMAP:
-			data = (byte *)mem_alloc(entry->size);
+			data = BigfileGetContents(bigfile, entry);
 			size = entry->size;
-			BigfileSeekContents(bigfile, data, entry);
 			entry->data = (byte *)LzDec((int *)&entry->size, data, 0, size, true);
 			entry->timlayers = 1;
 			// extract as TIM
@@ -4625,14 +5248,15 @@ void BigFile_ExtractEntry(int argc, char **argv, FILE *bigfile, bigfileentry_t *
 				TGAfromTIM(bigfile, entry, filename, false, true, true, timscaler | (timscalecustom ? (timscaleastilemap ? FILTER_TRANSFORM_TILEMAP8X8 : 0) : FILTER_TRANSFORM_TILEMAP8X8) | FILTER_TRANSFORM_CREATEBORDER, colorscale, colorsub); 
 			}
 			else Error("Tilemap2Tga: unknown format '%s'\n", format);
-			mem_free(data);
+			BigfileReleaseContents(data);
+			if (entry->data)
+				mem_free(entry->data);
 			entry->data = NULL;
 			entry->size = size;
 			break;
 		case BIGENTRY_MAP:
 			bigfileheader = ReadBigfileHeader(bigfile, false, false);
-			entry->data = (byte *)mem_alloc(entry->size);
-			BigfileSeekContents(bigfile, entry->data, entry);
+			entry->data = BigfileGetContents(bigfile, entry);
 			if (!stricmp(format, "tga"))
 			{
 				DefaultExtension(filename, ".tga", sizeof(filename));
@@ -4644,7 +5268,7 @@ void BigFile_ExtractEntry(int argc, char **argv, FILE *bigfile, bigfileentry_t *
 				MapExportTXT(entry->name, entry->data, entry->size, filename, bigfileheader, bigfile, "");
 			}
 			else Error("ExtractMap: unknown format '%s'\n", format);
-			mem_free(entry->data);
+			BigfileReleaseContents(entry->data);
 			FreeBigfileHeader(bigfileheader);
 			entry->data = NULL;
 			break;
@@ -4652,47 +5276,304 @@ void BigFile_ExtractEntry(int argc, char **argv, FILE *bigfile, bigfileentry_t *
 			Error("bad entry type\n");
 			break;
 	}
+	return ok;
 }
 
-// "-bigfile c:/pill.big -extract 0AD312F45 0AD312F45.tga"
-int BigFile_Extract(int argc, char **argv)
+// batch extraction, entries are extracted in order of their offsets in bigfile
+typedef struct
 {
-	char outfile[MAX_OSPATH];
-	unsigned int hash;
+	bigfileheader_t *data;
+	bigfilespan_t   *spans;
+	char            *dstdir;
+	char            *format;
+	int              argc;
+	char           **argv;
+}extractjobs_t;
+
+// BigFile_ExtractEntry fails with Error() on unsupported formats, so callers that go on
+// after an entry (batch extraction, serve) check it first
+static bool BigfileFormatSupported(bigentrytype_t type, char *format)
+{
+	if (!stricmp(format, "raw"))
+		return true;
+	switch(type)
+	{
+		case BIGENTRY_TIM:
+		case BIGENTRY_TILEMAP:
+			return !stricmp(format, "tga") || !stricmp(format, "tga24") || !stricmp(format, "tga32") || !stricmp(format, "tga8_24") || !stricmp(format, "tga8_32");
+		case BIGENTRY_RAW_ADPCM:
+		case BIGENTRY_RIFF_WAVE:
+		case BIGENTRY_VAG:
+			return !stricmp(format, "wav") || !stricmp(format, "ogg");
+		case BIGENTRY_SPRITE:
+			return !stricmp(format, "tga") || !stricmp(format, "spr32");
+		case BIGENTRY_MAP:
+			return !stricmp(format, "tga") || !stricmp(format, "txt");
+		default:
+			return false;
+	}
+}
+
+// pick output file for entry extracted in batch
+// without format given, entries are converted to TGA/WAV by their type
+static void BigfileExtractName(bigfileentry_t *entry, char *dstdir, char *format, char *outfile)
+{
+	char basename[MAX_OSPATH];
+
+	StripFileExtension(entry->name, basename);
+	if (!stricmp(format, "raw") || (!format[0] && entry->type == BIGENTRY_UNKNOWN))
+		sprintf(outfile, "%s/%s", dstdir, entry->name);
+	else if (!strnicmp(format, "tga", 3))
+		sprintf(outfile, "%s/%s.tga", dstdir, basename);
+	else if (format[0])
+		sprintf(outfile, "%s/%s.%s", dstdir, basename, format);
+	else if (entry->type == BIGENTRY_RAW_ADPCM || entry->type == BIGENTRY_RIFF_WAVE || entry->type == BIGENTRY_VAG)
+		sprintf(outfile, "%s/%s.wav", dstdir, basename);
+	else
+		sprintf(outfile, "%s/%s.tga", dstdir, basename);
+}
+
+static void BigFile_ExtractJob(int i, void *jobsdata)
+{
+	extractjobs_t *jobs = (extractjobs_t *)jobsdata;
 	bigfileentry_t *entry;
+	char outfile[MAX_OSPATH], path[MAX_OSPATH], format[128], **argv;
+	bool locked;
 	FILE *f;
 
-	// read source hash and out file
-	if (argc < 2)
-		Error("not enough parms");
-	hash = BigfileEntryHashFromString(argv[0], true);
-	strcpy(outfile, argv[1]);
-	// open, get entry, scan, extract
+	entry = &jobs->data->entries[jobs->spans[i].entry];
+	BigfileExtractName(entry, jobs->dstdir, jobs->format, outfile);
+
+	// format is given explicitly, as unknown entries keep their own extension
+	if (jobs->format[0])
+		strlcpy(format, jobs->format, sizeof(format));
+	else if (entry->type == BIGENTRY_UNKNOWN)
+		strcpy(format, "raw");
+	else
+		ExtractFileExtension(outfile, format);
+	if (!BigfileFormatSupported(entry->type, format))
+	{
+		Warning("%s: %s entry could not be extracted as '%s', skipped", entry->name, UnparseBigentryType(entry->type), format);
+		return;
+	}
+	ExtractFilePath(outfile, path);
+	if (path[0])
+		CreatePath(path);
+	argv = (char **)mem_alloc(sizeof(char *) * (jobs->argc + 2));
+	argv[0] = "-f";
+	argv[1] = format;
+	memcpy(argv + 2, jobs->argv, sizeof(char *) * jobs->argc);
+
+	// every job reads with it's own stream, map renderer is not shared (SoX runs are limited by it's own worker pool)
 	f = SafeOpen(bigfile, "rb");
-	entry = ReadBigfileHeaderOneEntry(f, hash);
-	if (entry == NULL)
-		Error("Failed to find entry %.8X\n", hash);
-	BigfileScanFiletype(f, entry, true, RAW_TYPE_UNKNOWN, true);
-	BigFile_ExtractEntry(argc-2, argv+2, f, entry, outfile);
-	mem_free(entry);
+	locked = (entry->type == BIGENTRY_MAP);
+	if (locked)
+		BigFileUnpackLock();
+	BigFile_ExtractEntry(jobs->argc + 2, argv, f, entry, outfile);
+	if (locked)
+		BigFileUnpackUnlock();
 	fclose(f);
-	return 0;
+	mem_free(argv);
 }
 
-/*
-==========================================================================================
+// "-bigfile c:/pill.big -extract @list.txt outdir" or "-extract sound/*.adpcm outdir"
+// list file holds entry names, #hashes, wildcards or $types, one per line
+int BigFile_ExtractBatch(int argc, char **argv)
+{
+	extractjobs_t jobs;
+	bigfileheader_t *data;
+	bigfileentry_t *entry;
+	char line[MAX_OSPATH], dstdir[MAX_OSPATH], format[128], *c;
+	unsigned int hash;
+	bool *selected;
+	list_t *patterns;
+	int i, numspans;
+	FILE *f;
 
-  -bigfile -unpack
+	if (argc < 2)
+		Error("not enough parms");
+	strlcpy(dstdir, argv[1], sizeof(dstdir));
+	format[0] = 0;
+	for (i = 2; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-f") && i + 1 < argc)
+			strlcpy(format, argv[i + 1], sizeof(format));
+		Thread_ParseOption(argc, argv, &i);
+	}
 
-  unpack whole bigfile to a folder
+	// load header once and detect types of all entries
+	f = SafeOpen(bigfile, "rb");
+	BigfileOpenView(f);
+	data = ReadBigfileHeader(f, false, false);
+	BigfileScanFiletypes(f, data, true, NULL, RAW_TYPE_UNKNOWN);
+	BigfileCloseView(f);
+	fclose(f);
 
-==========================================================================================
-*/
+	// select entries, names and hashes are looked up directly, rest goes to wildcard list
+	selected = (bool *)mem_alloc(sizeof(bool) * data->numentries);
+	memset(selected, 0, sizeof(bool) * data->numentries);
+	patterns = NewList();
+	if (argv[0][0] == '@')
+	{
+		f = SafeOpen(argv[0] + 1, "r");
+		while(fgets(line, sizeof(line), f))
+		{
+			for (c = line + strlen(line) - 1; c >= line && (*c == '\n' || *c == '\r' || *c == ' ' || *c == '\t'); c--)
+				*c = 0;
+			if (!line[0] || !strncmp(line, "//", 2))
+				continue;
+			if (line[0] == '$' || strchr(line, '*') || strchr(line, '?'))
+			{
+				if (patterns->items >= MAX_LIST_ITEMS)
+					Error("%s: too many wildcards (max %i)", argv[0] + 1, MAX_LIST_ITEMS);
+				ListAdd(patterns, line, true);
+				continue;
+			}
+			hash = BigfileEntryHashFromString(line, false);
+			entry = hash ? BigfileGetEntry(data, hash) : NULL;
+			if (!entry)
+			{
+				Warning("%s: no entry '%s'", argv[0] + 1, line);
+				continue;
+			}
+			selected[entry - data->entries] = true;
+		}
+		fclose(f);
+	}
+	else
+		ListAdd(patterns, argv[0], true);
+	if (patterns->items)
+		for (i = 0; i < (int)data->numentries; i++)
+			if (MatchIXList(&data->entries[i], patterns, true, true))
+				selected[i] = true;
 
-int BigFile_Unpack(int argc, char **argv)
-{
-	FILE *f, *f2;
-	char savefile[MAX_OSPATH], dstdir[MAX_OSPATH];
+	// sort by offset for sequential reading
+	jobs.spans = (bigfilespan_t *)mem_alloc(sizeof(bigfilespan_t) * (data->numentries + 1));
+	numspans = 0;
+	for (i = 0; i < (int)data->numentries; i++)
+	{
+		if (!selected[i] || !data->entries[i].size)
+			continue;
+		jobs.spans[numspans].offset = data->entries[i].offset;
+		jobs.spans[numspans].size = data->entries[i].size;
+		jobs.spans[numspans].entry = i;
+		numspans++;
+	}
+	qsort(jobs.spans, numspans, sizeof(bigfilespan_t), BigfileSpanCompare);
+	Print("%i entries to extract\n", numspans);
+
+	// extract
+	jobs.data = data;
+	jobs.dstdir = dstdir;
+	jobs.format = format;
+	jobs.argc = argc - 2;
+	jobs.argv = argv + 2;
+	if (numthreads > 1)
+	{
+		Verbose("extracting with %i threads\n", numthreads);
+		unpackmutex = Thread_CreateMutex();
+	}
+	Thread_RunJobs(numspans, BigFile_ExtractJob, &jobs);
+	Thread_DestroyMutex(unpackmutex);
+	unpackmutex = NULL;
+
+	mem_free(jobs.spans);
+	mem_free(selected);
+	FreeList(patterns);
+	FreeBigfileHeader(data);
+	Print("done.\n");
+	return 0;
+}
+
+// "-bigfile c:/pill.big -extract 0AD312F45 0AD312F45.tga"
+int BigFile_Extract(int argc, char **argv)
+{
+	char outfile[MAX_OSPATH];
+	unsigned int hash;
+	bigfileentry_t *entry;
+	bigfilecache_t *cache;
+	bigentrytype_t type;
+	FILE *f;
+
+	// read source hash and out file
+	if (argc < 2)
+		Error("not enough parms");
+	// many entries at once
+	if (argv[0][0] == '@' || argv[0][0] == '$' || strchr(argv[0], '*') || strchr(argv[0], '?'))
+		return BigFile_ExtractBatch(argc, argv);
+	hash = BigfileEntryHashFromString(argv[0], true);
+	strcpy(outfile, argv[1]);
+	// open, get entry, scan, extract
+	f = SafeOpen(bigfile, "rb");
+	BigfileOpenView(f);
+	entry = ReadBigfileHeaderOneEntry(f, hash);
+	if (entry == NULL)
+		Error("Failed to find entry %.8X\n", hash);
+	cache = BigfileOpenCache(f);
+	if (!BigfileCacheGet(cache, -1, entry, &type))
+	{
+		type = BigfileDetectFiletype(f, entry, true, RAW_TYPE_UNKNOWN);
+		BigfileCachePut(cache, BigfileCacheFind(cache, entry->hash), entry, type);
+	}
+	BigfileCloseCache(cache);
+	BigfileSetFiletype(entry, type, true);
+	if (!BigFile_ExtractEntry(argc-2, argv+2, f, entry, outfile))
+		Error("unable to extract %s", outfile);
+	mem_free(entry);
+	BigfileCloseView(f);
+	fclose(f);
+	return 0;
+}
+
+/*
+==========================================================================================
+
+  -bigfile -unpack
+
+  unpack whole bigfile to a folder
+
+==========================================================================================
+*/
+
+typedef struct
+{
+	bigfileheader_t *data;
+	FILE            *f;
+	list_t          *ixlist;
+	char            *dstdir;
+	bool             tim2tga, bpp16to24, nopaths, rawconvert, rawnoalign, map2tga, map_show_triggers, map_show_lighting, map_show_contents, map_show_save_id, map_toggled_objects;
+	int              adpcmconvert, vagconvert;
+	rawtype_t        forcerawtype;
+}
+unpackjobs_t;
+
+// unpack single entry, called by worker threads
+void BigFile_UnpackJob(int i, void *parm)
+{
+	unpackjobs_t *jobs;
+	bigfileentry_t *entry;
+
+	jobs = (unpackjobs_t *)parm;
+	entry = &jobs->data->entries[i];
+	if (jobs->ixlist->items)
+		if (!MatchIXList(entry, jobs->ixlist, true, true))
+			return;
+	Pacifier("unpacking entry %i of %i...", i + 1, jobs->data->numentries);
+	// shared stream should not be read by several threads at once
+	if (!BigfileGetView(jobs->f) && entry->size > 0)
+	{
+		BigFileUnpackLock();
+		entry->data = BigfileGetContents(jobs->f, entry);
+		BigFileUnpackUnlock();
+	}
+	BigFileUnpackEntry(jobs->data, jobs->f, entry, jobs->dstdir, jobs->tim2tga, jobs->bpp16to24, jobs->nopaths, jobs->adpcmconvert, jobs->vagconvert, jobs->rawconvert, jobs->forcerawtype, jobs->rawnoalign, jobs->map2tga, jobs->map_show_contents, jobs->map_show_triggers, jobs->map_show_lighting, jobs->map_show_save_id, jobs->map_toggled_objects);
+}
+
+int BigFile_Unpack(int argc, char **argv)
+{
+	FILE *f, *f2;
+	char savefile[MAX_OSPATH], dstdir[MAX_OSPATH];
+	unpackjobs_t jobs;
 	bool tim2tga, bpp16to24, nopaths, rawconvert, rawnoalign, hashnamesonly, map2tga, map_show_triggers, map_show_lighting, map_show_contents, map_show_save_id, map_toggled_objects;
 	rawtype_t forcerawtype;
 	bigfileheader_t *data;
@@ -4728,7 +5609,7 @@ int BigFile_Unpack(int argc, char **argv)
 		{
 			if (!strcmp(argv[i], "-x"))
 			{
-				i++; 
+				i++;
 				if (i < argc)
 					ListAdd(ixlist, argv[i], false);
 				Verbose("Option: exclude mask '%s'\n", argv[i]);
@@ -4736,7 +5617,7 @@ int BigFile_Unpack(int argc, char **argv)
 			}
 			if (!strcmp(argv[i], "-i"))
 			{
-				i++; 
+				i++;
 				if (i < argc)
 					ListAdd(ixlist, argv[i], true);
 				Verbose("Option: include mask '%s'\n", argv[i]);
@@ -4748,6 +5629,8 @@ int BigFile_Unpack(int argc, char **argv)
 				Verbose("Option: use pure hash names\n");
 				continue;
 			}
+			if (Thread_ParseOption(argc, argv, &i))
+				continue;
 			if (!strcmp(argv[i], "-tim2tga"))
 			{
 				tim2tga = true;
@@ -4820,7 +5703,7 @@ int BigFile_Unpack(int argc, char **argv)
 				Verbose("Option: ADPCM->OGG (Vorbis quality 5) conversion\n");
 				continue;
 			}
-			if (!strcmp(argv[i], "-vag2wav"))
+			if (!strcmp(argv[i], "-vag2pcm") || !strcmp(argv[i], "-vag2wav"))
 			{
 				vagconvert = 2;
 				Verbose("Option: VAG->WAV (PCM native) conversion\n");
@@ -4861,18 +5744,38 @@ int BigFile_Unpack(int argc, char **argv)
 
 	// open file & load header
 	f = SafeOpen(bigfile, "rb");
+	BigfileOpenView(f);
 	data = ReadBigfileHeader(f, false, hashnamesonly);
 	BigfileScanFiletypes(f, data, true, ixlist->items ? ixlist : NULL, forcerawtype);
 
 	// export all files
-	for (i = 0; i < (int)data->numentries; i++)
+	// entries are independent, so they are spread between worker threads
+	jobs.data = data;
+	jobs.f = f;
+	jobs.ixlist = ixlist;
+	jobs.dstdir = dstdir;
+	jobs.tim2tga = tim2tga;
+	jobs.bpp16to24 = bpp16to24;
+	jobs.nopaths = nopaths;
+	jobs.rawconvert = rawconvert;
+	jobs.rawnoalign = rawnoalign;
+	jobs.map2tga = map2tga;
+	jobs.map_show_triggers = map_show_triggers;
+	jobs.map_show_lighting = map_show_lighting;
+	jobs.map_show_contents = map_show_contents;
+	jobs.map_show_save_id = map_show_save_id;
+	jobs.map_toggled_objects = map_toggled_objects;
+	jobs.adpcmconvert = adpcmconvert;
+	jobs.vagconvert = vagconvert;
+	jobs.forcerawtype = forcerawtype;
+	if (numthreads > 1)
 	{
-		if (ixlist->items)
-			if (!MatchIXList(&data->entries[i], ixlist, true, true))
-				continue;
-		Pacifier("unpacking entry %i of %i...", i + 1, data->numentries);
-		BigFileUnpackEntry(data, f, &data->entries[i], dstdir, tim2tga, bpp16to24, nopaths, adpcmconvert, vagconvert, rawconvert, forcerawtype, rawnoalign, map2tga, map_show_contents, map_show_triggers, map_show_lighting, map_show_save_id, map_toggled_objects);
+		Verbose("unpacking with %i threads\n", numthreads);
+		unpackmutex = Thread_CreateMutex();
 	}
+	Thread_RunJobs(data->numentries, BigFile_UnpackJob, &jobs);
+	Thread_DestroyMutex(unpackmutex);
+	unpackmutex = NULL;
 	PacifierEnd();
 
 	// write listfile
@@ -4884,445 +5787,2221 @@ int BigFile_Unpack(int argc, char **argv)
 
 	FreeBigfileHeader(data);
 	FreeList(ixlist);
+	BigfileCloseView(f);
 	fclose (f);
 	return 0;
 }
 
-int BigFile_Pack(int argc, char **argv)
+// packing is done in two stages: entries are converted by worker threads, then
+// header and all entries are written in order, raw files are copied with big chunks
+#define PACK_COPYBUFFER (1024 * 1024 * 4)
+#define PACK_WRITEBUFFER (1024 * 64)
+#define PACK_DEFAULT_MEMBUDGET 256 // megabytes
+
+typedef struct
+{
+	char         srcfile[MAX_OSPATH];
+	tim_image_t *tim[1 + MAX_TIM_MASKS]; // converted TIM layers
+	byte        *data;                   // converted data
+	int          spillofs;               // converted data was moved to spill file, -1 if not
+	int          oldofs;                 // unchanged entry is copied from previous bigfile, -1 if not
+	int          dupof;                  // entry has same contents as this entry, -1 if not
+}packentry_t;
+
+typedef struct
 {
-	FILE *f;
 	bigfileheader_t *data;
-	bigfileentry_t *entry;
-	tim_image_t *tim;
-	char savefile[MAX_OSPATH], basename[MAX_OSPATH], srcdir[MAX_OSPATH], ext[128];
-	byte *contents;
-	int i, k, size;
+	packentry_t     *packentries;
+	char            *srcdir;
+	void            *mutex;
+	// converted data held in memory, goes to spill file once budget is exceeded
+	int              memused;
+	int              membudget;
+	FILE            *spill;
+	int              spilled;
+	// incremental packing
+	bool             incremental;
+	bigfileheader_t *oldheader;
+	FILE            *oldfile;
+	int              reused;
+	// deduplication
+	bool             dedup;
+	int              duplicates;
+	int              dupbytes;
+}packjobs_t;
 
-	// check parms
-	strcpy(srcdir, DEFAULT_PACKPATH);
-	if (argc > 0)
+typedef struct
+{
+	unsigned int size;
+	unsigned int crc;
+	int          entry;
+}packdup_t;
+
+// copy part of stream to another stream
+static void BigfilePackCopy(FILE *f, FILE *src, char *srcname, int size, byte *buffer, int buffersize)
+{
+	int chunk;
+
+	while(size > 0)
 	{
-		if (argv[0][0] != '-')
-		{
-			strcpy(srcdir, argv[0]);
-			Verbose("Option: source directory '%s'\n", srcdir);
-		}
-		for (i = 0; i < argc; i++)
-		{
-			if (i != 0)
-				Warning("unknown parameter '%s'",  argv[i]);
-		}
+		chunk = min(size, buffersize);
+		if (fread(buffer, chunk, 1, src) != 1)
+			Error("%s: read failure (file was changed?)", srcname);
+		SafeWrite(f, buffer, chunk);
+		size -= chunk;
 	}
+}
 
-	// open listfile
-	data = BigfileOpenListfile(srcdir);
+// keep converted entry in memory or move it to spill file
+static void BigfilePackStore(packjobs_t *jobs, bigfileentry_t *entry, packentry_t *pentry)
+{
+	int k;
 
-	// open bigfile
-	f = fopen(bigfile, "rb");
-	if (f)
+	Thread_LockMutex(jobs->mutex);
+	if (jobs->memused + (int)entry->size <= jobs->membudget)
 	{
-		Verbose("%s already exists, overwriting\n", bigfile);
-		fclose(f);
+		jobs->memused += entry->size;
+		Thread_UnlockMutex(jobs->mutex);
+		return;
+	}
+	if (!jobs->spill)
+	{
+		jobs->spill = tmpfile();
+		if (!jobs->spill)
+			Error("BigFile_Pack: unable to create spill file");
+	}
+	fseek(jobs->spill, 0, SEEK_END);
+	pentry->spillofs = ftell(jobs->spill);
+	if (pentry->tim[0])
+	{
+		for (k = 0; k < 1 + MAX_TIM_MASKS && pentry->tim[k]; k++)
+		{
+			TIM_WriteToStream(pentry->tim[k], jobs->spill);
+			FreeTIM(pentry->tim[k]);
+			pentry->tim[k] = NULL;
+		}
+	}
+	else
+	{
+		SafeWrite(jobs->spill, pentry->data, entry->size);
+		mem_free(pentry->data);
+		pentry->data = NULL;
 	}
-	f = SafeOpenWrite(bigfile);
+	jobs->spilled++;
+	Thread_UnlockMutex(jobs->mutex);
+}
 
-	// write entries count, write headers later
-	SafeWrite(f, &data->numentries, 4);
-	fseek(f, data->numentries*12, SEEK_CUR);
+// list all source files entry is made of (TIM layers and masks or single file)
+#define PACK_MAX_SOURCES ((1 + MAX_TIM_MASKS) * 2)
+static int BigfilePackSources(packjobs_t *jobs, bigfileentry_t *entry, char sources[PACK_MAX_SOURCES][MAX_OSPATH])
+{
+	char basename[MAX_OSPATH], layer[MAX_OSPATH], ext[128];
+	int k, num;
 
-	// write files
-	for (i = 0; i < (int)data->numentries; i++)
+	ExtractFileExtension(entry->name, ext);
+	if (strcmp(ext, "tga") || entry->type != BIGENTRY_TIM)
 	{
-		entry = &data->entries[i];
-
-		if (entry->size == 0)
-			continue; // skip null files
+		sprintf(sources[0], "%s/%s", jobs->srcdir, entry->name);
+		return 1;
+	}
+	StripFileExtension(entry->name, basename);
+	num = 0;
+	for (k = 0; k < max(1, entry->timlayers); k++)
+	{
+		if (k == 0)
+			sprintf(layer, "%s/%s", jobs->srcdir, basename);
+		else
+			sprintf(layer, "%s/%s_sub%i", jobs->srcdir, basename, k);
+		sprintf(sources[num++], "%s.tga", layer);
+		sprintf(sources[num], "%s_mask.tga", layer);
+		if (FileExists(sources[num]))
+			num++;
+	}
+	return num;
+}
 
-		Pacifier("writing entry %i of %i...", i + 1, data->numentries);
+// get modification time, total size and checksum of entry source files
+static void BigfilePackSourceInfo(packjobs_t *jobs, bigfileentry_t *entry, bool withcrc, int *time, unsigned int *size, unsigned int *crc)
+{
+	char sources[PACK_MAX_SOURCES][MAX_OSPATH];
+	unsigned int crcs[PACK_MAX_SOURCES];
+	byte *filedata;
+	int i, num, filelen;
 
-		ExtractFileExtension(entry->name, ext);
-		// autoconverted TIM
-		if (!strcmp(ext, "tga") && entry->type == BIGENTRY_TIM)
-		{
-			sprintf(savefile, "%s/%s", srcdir, entry->name);
-			entry->data = (byte *)TIM_LoadFromTarga(savefile, entry->timtype[0]);
-			size = ((tim_image_t *)entry->data)->filelen;
-			TIM_WriteToStream((tim_image_t *)entry->data, f);
-			FreeTIM((tim_image_t *)entry->data);
-			// add sublayers
-			StripFileExtension(entry->name, basename);
-			for (k = 1; k < entry->timlayers; k++)
-			{
-				sprintf(savefile, "%s/%s_sub%i.tga", srcdir, basename, k);
-				tim = TIM_LoadFromTarga(savefile, entry->timtype[k]); 
-				size += tim->filelen;
-				TIM_WriteToStream(tim, f);
-				FreeTIM(tim);
-			}
-			entry->size = size;
-		}
-		// autoconverted WAV/OGG
-		else if ((!strcmp(ext, "wav") || !strcmp(ext, "ogg")) && entry->type == BIGENTRY_RAW_ADPCM)
+	num = BigfilePackSources(jobs, entry, sources);
+	*time = 0;
+	*size = 0;
+	*crc = 0;
+	for (i = 0; i < num; i++)
+	{
+		*time = max(*time, FileTime(sources[i]));
+		if (withcrc)
 		{
-			sprintf(savefile, "%s/%s", srcdir, entry->name);
-			if (!SoX_FileToData(savefile, "--no-dither", "", "-t ima -c 1", &size, &contents, ""))
-				Error("unable to convert %s, SoX Error\n", entry->name);
-			entry->data = contents;
-			entry->size = size;
-			// write
-			SafeWrite(f, entry->data, entry->size);
-			mem_free(entry->data);
+			filelen = LoadFile(sources[i], &filedata);
+			crcs[i] = crc32(filedata, filelen);
+			*size += filelen;
+			mem_free(filedata);
 		}
-		// just write
 		else
-		{
-			sprintf(savefile, "%s/%s", srcdir, entry->name);
-			entry->size = LoadFile(savefile, &entry->data);
-			SafeWrite(f, entry->data, entry->size);
-			mem_free(entry->data);
-		}
+			*size += (unsigned int)FileSize(sources[i]);
 	}
-	PacifierEnd();
+	if (withcrc)
+		*crc = crc32((unsigned char *)crcs, num * sizeof(unsigned int));
+}
 
-	// write headers
-	Verbose("Recalculating offsets...\n", bigfile);
-	BigfileHeaderRecalcOffsets(data, 0);
-	fseek(f, 4, SEEK_SET);
-	for (i = 0; i < (int)data->numentries; i++)
+// checksum of listfile settings entry is converted with, same ones BigfileWriteListfile saves
+static unsigned int BigfilePackParms(bigfileentry_t *entry)
+{
+	int parms[2 + 1 + MAX_TIM_MASKS + 13];
+	rawinfo_t *rawinfo;
+	int k, num;
+
+	num = 0;
+	parms[num++] = (int)entry->type;
+	switch(entry->type)
 	{
-		entry = &data->entries[i];
-		Pacifier("writing header %i of %i...", i + 1, data->numentries);
-		SafeWrite(f, &entry->hash, 4);
-		SafeWrite(f, &entry->size, 4);
-		SafeWrite(f, &entry->offset, 4);
+		case BIGENTRY_TIM:
+			parms[num++] = entry->timlayers;
+			for (k = 0; k < entry->timlayers && k < 1 + MAX_TIM_MASKS; k++)
+				parms[num++] = (int)entry->timtype[k];
+			break;
+		case BIGENTRY_RAW_ADPCM:
+			parms[num++] = entry->adpcmrate;
+			break;
+		case BIGENTRY_SPRITE:
+			rawinfo = &entry->rawinfo;
+			parms[num++] = (int)rawinfo->type;
+			parms[num++] = rawinfo->width;
+			parms[num++] = rawinfo->height;
+			parms[num++] = rawinfo->offset;
+			parms[num++] = rawinfo->bytes;
+			parms[num++] = (int)rawinfo->doubleres;
+			parms[num++] = rawinfo->chunknum;
+			parms[num++] = rawinfo->colormapoffset;
+			parms[num++] = rawinfo->colormapbytes;
+			parms[num++] = rawinfo->disableCLUT ? 1 : 0;
+			parms[num++] = rawinfo->dontSwapBgr ? 1 : 0;
+			parms[num++] = rawinfo->shadowpixel;
+			parms[num++] = rawinfo->shadowalpha;
+			break;
+		default:
+			break;
 	}
-	PacifierEnd();
-
-	WriteClose(f);
-	FreeBigfileHeader(data);
-	Print("done.\n");
-	return 0;
+	return crc32((unsigned char *)parms, num * sizeof(int));
 }
 
-/*
-==========================================================================================
-
-  Patch
-
-==========================================================================================
-*/
+// check if entry sources and settings are same as on previous pack and previous bigfile still holds the entry
+static bool BigfilePackUnchanged(packjobs_t *jobs, bigfileentry_t *entry)
+{
+	bigfileentry_t *oldentry;
+	unsigned int size, crc;
+	int time;
 
-#define MAX_PATCHFILES 1000
-#define PILL_BIG_BIGGEST_ENTRY 1024 * 1024 * 4
+	if (!entry->srcsize)
+		return false;
+	if (BigfilePackParms(entry) != entry->srcparms)
+		return false;
+	oldentry = BigfileGetEntry(jobs->oldheader, entry->hash);
+	if (!oldentry || oldentry->size != entry->size || oldentry->offset != entry->offset)
+		return false;
+	BigfilePackSourceInfo(jobs, entry, false, &time, &size, &crc);
+	if (size != entry->srcsize)
+		return false;
+	// file was touched, compare contents
+	if (time != entry->srctime)
+	{
+		BigfilePackSourceInfo(jobs, entry, true, &time, &size, &crc);
+		if (crc != entry->srccrc)
+			return false;
+		entry->srctime = time;
+	}
+	return true;
+}
 
-typedef enum
+// incremental packing self-check: entry is reused only while both sources and settings are the same
+static int BigfilePackTestCase(packjobs_t *jobs, bigfileentry_t *entry, bool reused, char *what)
 {
-	PATCH_RAW,
-	PATCH_SOUND2ADPCM,
-	PATCH_TGA2TIM
-}patchconv_t;
+	if (BigfilePackUnchanged(jobs, entry) == reused)
+		return 0;
+	Print("incremental pack test: %s %s\n", what, reused ? "is not reused" : "is reused");
+	return 1;
+}
 
-typedef struct
+int BigfilePackSelfTest(void)
 {
-	// bigfile entry this file points to
-	bigfileentry_t *entry;
-	unsigned int hash;
-	// file data
-	byte *data;
-	int datasize;
-}patchfile_t;
+	bigfileheader_t oldheader;
+	bigfileentry_t oldentry, entry;
+	packjobs_t jobs;
+	char tempfile[MAX_OSPATH], tempdir[MAX_OSPATH];
+	FILE *f;
+	int failed, l;
 
-#define chunksize (1024 * 1024 * 4)
-unsigned char chunkdata[chunksize];
-int BigFile_Patch(int argc, char **argv)
+	// single source file in temp dir, previous bigfile holds entry at same place
+	TempFileName(tempfile);
+	f = fopen(tempfile, "wb");
+	if (!f)
+	{
+		Print("incremental pack test: unable to write %s: %s\n", tempfile, strerror(errno));
+		return 1;
+	}
+	fprintf(f, "blood pill incremental pack test\n");
+	fclose(f);
+	ExtractFilePath(tempfile, tempdir);
+	l = strlen(tempdir);
+	if (l > 0 && (tempdir[l - 1] == '/' || tempdir[l - 1] == '\\'))
+		tempdir[l - 1] = 0;
+	memset(&entry, 0, sizeof(entry));
+	BigfileEmptyEntry(&entry);
+	entry.hash = 0x12345678;
+	entry.size = 1024;
+	entry.offset = 16;
+	ExtractFileName(tempfile, entry.name);
+	oldentry = entry;
+	oldheader.entries = &oldentry;
+	oldheader.numentries = 1;
+	oldheader.hashindex = NULL;
+	memset(&jobs, 0, sizeof(jobs));
+	jobs.srcdir = tempdir;
+	jobs.oldheader = &oldheader;
+	failed = 0;
+
+	// ADPCM rate
+	entry.type = BIGENTRY_RAW_ADPCM;
+	BigfilePackSourceInfo(&jobs, &entry, true, &entry.srctime, &entry.srcsize, &entry.srccrc);
+	entry.srcparms = BigfilePackParms(&entry);
+	failed += BigfilePackTestCase(&jobs, &entry, true, "unchanged ADPCM entry");
+	entry.adpcmrate = 22050;
+	failed += BigfilePackTestCase(&jobs, &entry, false, "ADPCM entry with changed rate");
+
+	// entry type
+	entry.type = BIGENTRY_UNKNOWN;
+	failed += BigfilePackTestCase(&jobs, &entry, false, "entry with changed type");
+
+	// TIM layers and layer types
+	entry.type = BIGENTRY_TIM;
+	entry.timlayers = 1;
+	entry.timtype[0] = 4;
+	entry.srcparms = BigfilePackParms(&entry);
+	failed += BigfilePackTestCase(&jobs, &entry, true, "unchanged TIM entry");
+	entry.timtype[0] = 8;
+	failed += BigfilePackTestCase(&jobs, &entry, false, "TIM entry with changed layer type");
+	entry.timtype[0] = 4;
+	entry.timlayers = 2;
+	entry.timtype[1] = 4;
+	failed += BigfilePackTestCase(&jobs, &entry, false, "TIM entry with changed layer count");
+
+	// raw info
+	entry.type = BIGENTRY_SPRITE;
+	FlushRawInfo(&entry.rawinfo);
+	entry.srcparms = BigfilePackParms(&entry);
+	failed += BigfilePackTestCase(&jobs, &entry, true, "unchanged sprite entry");
+	entry.rawinfo.shadowpixel = 0;
+	failed += BigfilePackTestCase(&jobs, &entry, false, "sprite entry with changed raw info");
+
+	remove(tempfile);
+	return failed;
+}
+
+// get size of entry, converting it if needed
+static void BigFile_PackJob(int i, void *jobsdata)
 {
-	char patchfile[MAX_OSPATH], outfile[MAX_OSPATH], entryname[MAX_OSPATH], convtype[1024], line[1024], *l;
-	int i, num_patchfiles, linenum, linebytes, linebytes_total, progress[4], patchedbytes, patchsize_total, chunkbytes;
-	patchfile_t patchfiles[MAX_PATCHFILES], *pfile;
-	bigfileheader_t *bigfilehead;
+	packjobs_t *jobs = (packjobs_t *)jobsdata;
 	bigfileentry_t *entry;
-	int entries_new = 0, entries_changesize = 0, entries_total = 0;
-	bool overwriting;
-	unsigned int num_entries, written_entries, ofs;
-	float p;
-	FILE *f, *bigf, *tmp;
+	packentry_t *pentry;
+	char savefile[MAX_OSPATH], basename[MAX_OSPATH], ext[128];
+	int k, size;
+	FILE *f;
 
-	if (argc < 1)
-		Error("not enough parms");
+	entry = &jobs->data->entries[i];
+	pentry = &jobs->packentries[i];
+	pentry->spillofs = -1;
+	pentry->oldofs = -1;
+	pentry->dupof = -1;
+	if (entry->size == 0)
+		return; // skip null files
 
-	// check parms
-	strcpy(patchfile, argv[0]);
-	strcpy(outfile, bigfile);
-	progress[0] = 5;
-	progress[1] = 40;
-	progress[2] = 60;
-	progress[3] = 100;
-	for (i = 1; i < argc; i++)
+	Pacifier("preparing entry %i of %i...", i + 1, jobs->data->numentries);
+
+	// incremental: unchanged entries are copied from previous bigfile
+	// source info is saved even without one, so next pack could reuse entries
+	if (jobs->incremental)
 	{
-		if (!strcmp(argv[i], "-outfile"))
+		if (jobs->oldheader && BigfilePackUnchanged(jobs, entry))
 		{
-			i++; 
-			if (i < argc)
-				strcpy(outfile, argv[i]);
-			Verbose("Option: output file '%s'\n", outfile);
-			continue;
+			pentry->oldofs = entry->offset;
+			Thread_AtomicIncrement(&jobs->reused);
+			return;
 		}
-		if (i != 0)
-			Warning("unknown parameter '%s'",  argv[i]);
+		BigfilePackSourceInfo(jobs, entry, true, &entry->srctime, &entry->srcsize, &entry->srccrc);
+		entry->srcparms = BigfilePackParms(entry);
 	}
 
-	// first step - (0-5) preload bigfile header
-	if (strcmp(bigfile, outfile))
+	sprintf(pentry->srcfile, "%s/%s", jobs->srcdir, entry->name);
+	ExtractFileExtension(entry->name, ext);
+	// autoconverted TIM
+	if (!strcmp(ext, "tga") && entry->type == BIGENTRY_TIM)
 	{
-		overwriting = false;
-		Verbose("Deriving patch destination (fast)\n", bigfile);
-		bigf = SafeOpen(bigfile, "rb");
+		pentry->tim[0] = TIM_LoadFromTarga(pentry->srcfile, entry->timtype[0]);
+		size = pentry->tim[0]->filelen;
+		// add sublayers
+		StripFileExtension(entry->name, basename);
+		for (k = 1; k < entry->timlayers; k++)
+		{
+			sprintf(savefile, "%s/%s_sub%i.tga", jobs->srcdir, basename, k);
+			pentry->tim[k] = TIM_LoadFromTarga(savefile, entry->timtype[k]); 
+			size += pentry->tim[k]->filelen;
+		}
+		entry->size = size;
+		// deduplication needs plain contents
+		if (jobs->dedup)
+		{
+			pentry->data = (byte *)mem_alloc(size);
+			size = 0;
+			for (k = 0; k < 1 + MAX_TIM_MASKS && pentry->tim[k]; k++)
+			{
+				TIM_WriteToBuffer(pentry->tim[k], pentry->data + size);
+				size += pentry->tim[k]->filelen;
+				FreeTIM(pentry->tim[k]);
+				pentry->tim[k] = NULL;
+			}
+		}
+		BigfilePackStore(jobs, entry, pentry);
 	}
-	else
+	// autoconverted WAV/OGG
+	else if ((!strcmp(ext, "wav") || !strcmp(ext, "ogg")) && entry->type == BIGENTRY_RAW_ADPCM)
 	{
-		overwriting = true;
-		Verbose("Overwriting patch destination (slow)\n", bigfile);
-		bigf = SafeOpen(bigfile, "rb+");
-		fseek(bigf, 0, SEEK_SET);
+		if (!SoX_FileToData(pentry->srcfile, "--no-dither", "", "-t ima -c 1", &size, &pentry->data, ""))
+			Error("unable to convert %s, SoX Error\n", entry->name);
+		entry->size = size;
+		BigfilePackStore(jobs, entry, pentry);
 	}
-	Verbose("Loading %s...\n", bigfile);
-	bigfilehead = ReadBigfileHeader(bigf, false, false);
-	for (i = 0; i < (int)bigfilehead->numentries; i++)
+	// just write
+	else
 	{
-		entry = &bigfilehead->entries[i];
-		// show pacifier
-		p = ((float)i / (float)bigfilehead->numentries) * progress[0];
-		PercentPacifier("%i", (int)p);
+		f = SafeOpen(pentry->srcfile, "rb");
+		entry->size = Q_filelength(f);
+		fclose(f);
 	}
+}
 
-	// second step - load patch files
-	Verbose("Loading patch file %s...\n", patchfile);
-	linenum = 0;
-	linebytes = 0;
-	num_patchfiles = 0;
-	patchsize_total = 0;
-	entries_new = false;
-	entries_changesize = false;
-	f = SafeOpen(patchfile, "rb");
-	linebytes_total = Q_filelength(f);
-	while(fgets(line, 1024, f))
+// read part of prepared entry contents
+static void BigfilePackReadEntry(packjobs_t *jobs, int i, int ofs, byte *buf, int len)
+{
+	packentry_t *pentry;
+	FILE *f;
+
+	pentry = &jobs->packentries[i];
+	if (pentry->data)
+	{
+		memcpy(buf, pentry->data + ofs, len);
+		return;
+	}
+	if (pentry->spillofs >= 0)
+	{
+		f = jobs->spill;
+		fseek(f, pentry->spillofs + ofs, SEEK_SET);
+	}
+	else if (pentry->oldofs >= 0)
+	{
+		f = jobs->oldfile;
+		fseek(f, pentry->oldofs + ofs, SEEK_SET);
+	}
+	else
+	{
+		f = SafeOpen(pentry->srcfile, "rb");
+		fseek(f, ofs, SEEK_SET);
+	}
+	if (fread(buf, len, 1, f) != 1)
+		Error("BigFile_Pack: read failure on entry %i (file was changed?)", i + 1);
+	if (f != jobs->spill && f != jobs->oldfile)
+		fclose(f);
+}
+
+static int PackDupCompare(const void *a, const void *b)
+{
+	packdup_t *dupa = (packdup_t *)a, *dupb = (packdup_t *)b;
+
+	if (dupa->size != dupb->size)
+		return (dupa->size < dupb->size) ? -1 : 1;
+	if (dupa->crc != dupb->crc)
+		return (dupa->crc < dupb->crc) ? -1 : 1;
+	return dupa->entry - dupb->entry;
+}
+
+// find entries with same contents, so they could share data in bigfile
+// candidates are picked by CRC and then compared byte by byte
+static void BigfilePackDedup(packjobs_t *jobs)
+{
+	bigfileentry_t *entry;
+	packentry_t *pentry;
+	packdup_t *dups;
+	byte *buf1, *buf2;
+	int i, j, ofs, len, numdups;
+	unsigned int crc;
+
+	buf1 = (byte *)mem_alloc(PACK_COPYBUFFER);
+	buf2 = (byte *)mem_alloc(PACK_COPYBUFFER);
+	dups = (packdup_t *)mem_alloc(sizeof(packdup_t) * (jobs->data->numentries + 1));
+	numdups = 0;
+	for (i = 0; i < (int)jobs->data->numentries; i++)
+	{
+		entry = &jobs->data->entries[i];
+		if (!entry->size)
+			continue;
+		Pacifier("hashing entry %i of %i...", i + 1, jobs->data->numentries);
+		crc = 0;
+		for (ofs = 0; ofs < (int)entry->size; ofs += len)
+		{
+			len = min((int)entry->size - ofs, PACK_COPYBUFFER);
+			BigfilePackReadEntry(jobs, i, ofs, buf1, len);
+			crc = crc32_update(crc, buf1, len);
+		}
+		dups[numdups].size = entry->size;
+		dups[numdups].crc = crc;
+		dups[numdups].entry = i;
+		numdups++;
+	}
+	PacifierEnd();
+
+	// first entry of each group keeps the data
+	qsort(dups, numdups, sizeof(packdup_t), PackDupCompare);
+	for (i = 0; i < numdups; i = j)
+	{
+		for (j = i + 1; j < numdups && dups[j].size == dups[i].size && dups[j].crc == dups[i].crc; j++)
+		{
+			for (ofs = 0; ofs < (int)dups[j].size; ofs += len)
+			{
+				len = min((int)dups[j].size - ofs, PACK_COPYBUFFER);
+				BigfilePackReadEntry(jobs, dups[i].entry, ofs, buf1, len);
+				BigfilePackReadEntry(jobs, dups[j].entry, ofs, buf2, len);
+				if (memcmp(buf1, buf2, len))
+					break;
+			}
+			if (ofs < (int)dups[j].size)
+				continue; // CRC collision
+			pentry = &jobs->packentries[dups[j].entry];
+			pentry->dupof = dups[i].entry;
+			if (pentry->data)
+			{
+				mem_free(pentry->data);
+				pentry->data = NULL;
+			}
+			jobs->duplicates++;
+			jobs->dupbytes += dups[j].size;
+		}
+	}
+	mem_free(dups);
+	mem_free(buf1);
+	mem_free(buf2);
+}
+
+int BigFile_Pack(int argc, char **argv)
+{
+	FILE *f, *src;
+	bigfileheader_t *data;
+	bigfileentry_t *entry;
+	packentry_t *pentry;
+	packjobs_t jobs;
+	char srcdir[MAX_OSPATH], outfile[MAX_OSPATH];
+	byte *header, *buffer;
+	int i, k, membudget, offset;
+	bool incremental, dedup;
+
+	// check parms
+	strcpy(srcdir, DEFAULT_PACKPATH);
+	membudget = PACK_DEFAULT_MEMBUDGET;
+	incremental = false;
+	dedup = false;
+	if (argc > 0)
+	{
+		if (argv[0][0] != '-')
+		{
+			strcpy(srcdir, argv[0]);
+			Verbose("Option: source directory '%s'\n", srcdir);
+		}
+		for (i = 0; i < argc; i++)
+		{
+			if (Thread_ParseOption(argc, argv, &i))
+				continue;
+			if (!strcmp(argv[i], "-membudget"))
+			{
+				i++;
+				if (i < argc)
+				{
+					membudget = max(0, atoi(argv[i]));
+					Verbose("Option: %i megabytes of converted data held in memory\n", membudget);
+				}
+				continue;
+			}
+			if (!strcmp(argv[i], "-incremental"))
+			{
+				incremental = true;
+				Verbose("Option: incremental packing\n");
+				continue;
+			}
+			if (!strcmp(argv[i], "-dedup"))
+			{
+				dedup = true;
+				Verbose("Option: share data of identical entries\n");
+				continue;
+			}
+			if (i != 0)
+				Warning("unknown parameter '%s'",  argv[i]);
+		}
+	}
+
+	// open listfile
+	data = BigfileOpenListfile(srcdir);
+	memset(&jobs, 0, sizeof(jobs));
+
+	// incremental packing reuses entries of previous bigfile, so new one is written to temp file
+	strcpy(outfile, bigfile);
+	jobs.incremental = incremental;
+	if (incremental)
+	{
+		jobs.oldfile = fopen(bigfile, "rb");
+		if (jobs.oldfile)
+		{
+			jobs.oldheader = ReadBigfileHeader(jobs.oldfile, false, true);
+			sprintf(outfile, "%s.tmp", bigfile);
+		}
+		else
+			Verbose("%s not found, packing all entries\n", bigfile);
+	}
+
+	// get sizes of all entries so header could be written at once
+	// raw files are only measured, converted ones are kept until written
+	jobs.data = data;
+	jobs.packentries = (packentry_t *)mem_alloc(sizeof(packentry_t) * data->numentries);
+	memset(jobs.packentries, 0, sizeof(packentry_t) * data->numentries);
+	jobs.srcdir = srcdir;
+	jobs.mutex = Thread_CreateMutex();
+	jobs.membudget = min(membudget, 2047) * 1024 * 1024;
+	jobs.dedup = dedup;
+	if (numthreads > 1)
+		Verbose("converting with %i threads\n", numthreads);
+	Thread_RunJobs(data->numentries, BigFile_PackJob, &jobs);
+	Thread_DestroyMutex(jobs.mutex);
+	PacifierEnd();
+	if (jobs.spilled)
+		Verbose("%i converted entries did not fit %i megabytes and were spilled to temp file\n", jobs.spilled, membudget);
+	if (jobs.oldfile)
+		Print("%i of %i entries are unchanged\n", jobs.reused, data->numentries);
+	if (dedup)
+	{
+		BigfilePackDedup(&jobs);
+		Print("%i duplicate entries, %i bytes saved\n", jobs.duplicates, jobs.dupbytes);
+	}
+
+	// duplicates point to data of first copy and take no space
+	offset = 4 + data->numentries*12;
+	for (i = 0; i < (int)data->numentries; i++)
+	{
+		entry = &data->entries[i];
+		entry->oldoffset = entry->offset;
+		if (jobs.packentries[i].dupof >= 0)
+		{
+			entry->offset = data->entries[jobs.packentries[i].dupof].offset;
+			continue;
+		}
+		entry->offset = (unsigned int)offset;
+		offset += entry->size;
+	}
+
+	// open bigfile, previous one is replaced after temp file is written
+	if (jobs.oldfile)
+		Verbose("writing %s, will replace %s\n", outfile, bigfile);
+	else
+	{
+		f = fopen(bigfile, "rb");
+		if (f)
+		{
+			Verbose("%s already exists, overwriting\n", bigfile);
+			fclose(f);
+		}
+	}
+	f = SafeOpenWrite(outfile);
+	setvbuf(f, NULL, _IOFBF, PACK_WRITEBUFFER);
+
+	// write header
+	header = (byte *)mem_alloc(4 + data->numentries*12);
+	memcpy(header, &data->numentries, 4);
+	for (i = 0; i < (int)data->numentries; i++)
+	{
+		entry = &data->entries[i];
+		memcpy(header + 4 + i*12, &entry->hash, 4);
+		memcpy(header + 4 + i*12 + 4, &entry->size, 4);
+		memcpy(header + 4 + i*12 + 8, &entry->offset, 4);
+	}
+	SafeWrite(f, header, 4 + data->numentries*12);
+	mem_free(header);
+
+	// write files
+	buffer = (byte *)mem_alloc(PACK_COPYBUFFER);
+	for (i = 0; i < (int)data->numentries; i++)
+	{
+		entry = &data->entries[i];
+		pentry = &jobs.packentries[i];
+
+		if (entry->size == 0 || pentry->dupof >= 0)
+			continue; // skip null files and duplicates
+
+		Pacifier("writing entry %i of %i...", i + 1, data->numentries);
+
+		if (pentry->tim[0])
+		{
+			for (k = 0; k < 1 + MAX_TIM_MASKS && pentry->tim[k]; k++)
+			{
+				TIM_WriteToStream(pentry->tim[k], f);
+				FreeTIM(pentry->tim[k]);
+			}
+		}
+		else if (pentry->data)
+		{
+			SafeWrite(f, pentry->data, entry->size);
+			mem_free(pentry->data);
+		}
+		else if (pentry->spillofs >= 0)
+		{
+			fseek(jobs.spill, pentry->spillofs, SEEK_SET);
+			BigfilePackCopy(f, jobs.spill, "spill file", entry->size, buffer, PACK_COPYBUFFER);
+		}
+		else if (pentry->oldofs >= 0)
+		{
+			fseek(jobs.oldfile, pentry->oldofs, SEEK_SET);
+			BigfilePackCopy(f, jobs.oldfile, bigfile, entry->size, buffer, PACK_COPYBUFFER);
+		}
+		else
+		{
+			// source is unbuffered so large reads go straight into copy buffer
+			src = SafeOpen(pentry->srcfile, "rb");
+			setvbuf(src, NULL, _IONBF, 0);
+			BigfilePackCopy(f, src, pentry->srcfile, entry->size, buffer, PACK_COPYBUFFER);
+			fclose(src);
+		}
+	}
+	PacifierEnd();
+	mem_free(buffer);
+	mem_free(jobs.packentries);
+	if (jobs.spill)
+		fclose(jobs.spill);
+	WriteClose(f);
+
+	// replace previous bigfile
+	if (jobs.oldfile)
+	{
+		fclose(jobs.oldfile);
+		FreeBigfileHeader(jobs.oldheader);
+		if (remove(bigfile))
+			Error("unable to replace %s: %s", bigfile, strerror(errno));
+		if (rename(outfile, bigfile))
+			Error("unable to rename %s to %s: %s", outfile, bigfile, strerror(errno));
+	}
+
+	// save source files info for next incremental pack
+	if (incremental)
+	{
+		sprintf(outfile, "%s/listfile.txt", srcdir);
+		f = SafeOpenWrite(outfile);
+		BigfileWriteListfile(f, data);
+		WriteClose(f);
+		Verbose("wrote %s\n", outfile);
+	}
+
+	FreeBigfileHeader(data);
+	Print("done.\n");
+	return 0;
+}
+
+/*
+==========================================================================================
+
+  Patch
+
+==========================================================================================
+*/
+
+typedef enum
+{
+	PATCH_RAW,
+	PATCH_SOUND2ADPCM,
+	PATCH_TGA2TIM
+}patchconv_t;
+
+typedef struct
+{
+	// bigfile entry this file points to
+	bigfileentry_t *entry;
+	unsigned int hash;
+	// file data: raw files are read when written, converted data is kept in memory
+	// or goes to spill file once memory budget is exceeded
+	char *srcfile;
+	byte *data;
+	int datasize;
+	int spillofs;
+	// new entries only, offset planned for data
+	unsigned int offset;
+}patchfile_t;
+
+// in-place patching: changed entries are written into free space (their own old place if
+// fits, gaps left by other changed entries, tail of file), and only entries overlapped
+// by grown header are moved; entries are not required to be contiguous by file format
+typedef struct
+{
+	unsigned int start;
+	unsigned int end;
+}patchrange_t;
+
+typedef struct
+{
+	bigfileentry_t *entry; // existing entry, NULL for new one
+	patchfile_t    *pfile; // new entry
+	unsigned int    size;
+}patchplace_t;
+
+typedef struct
+{
+	int          inplace;   // written over own data
+	int          relocated; // written into free gap
+	int          appended;  // written at end of file
+	int          displaced; // untouched entries moved out of header's way
+	int          deleted;
+	unsigned int writebytes;
+	unsigned int movebytes;
+	unsigned int oldsize;
+	unsigned int newsize;
+}patchplan_t;
+
+static int PatchRangeCompare(const void *a, const void *b)
+{
+	unsigned int sa = ((patchrange_t *)a)->start, sb = ((patchrange_t *)b)->start;
+	return (sa < sb) ? -1 : (sa > sb) ? 1 : 0;
+}
+
+static int PatchPlaceCompare(const void *a, const void *b)
+{
+	unsigned int sa = ((patchplace_t *)a)->size, sb = ((patchplace_t *)b)->size;
+	return (sa > sb) ? -1 : (sa < sb) ? 1 : 0;
+}
+
+// best-fit gap for data, or end of file
+static unsigned int BigfilePatchPlace(patchrange_t *gaps, int numgaps, patchplan_t *plan, unsigned int size, bool *appended)
+{
+	int i, best;
+
+	best = -1;
+	for (i = 0; i < numgaps; i++)
+		if (gaps[i].end - gaps[i].start >= size && (best < 0 || gaps[i].end - gaps[i].start < gaps[best].end - gaps[best].start))
+			best = i;
+	if (best < 0)
+	{
+		*appended = true;
+		plan->newsize += size;
+		return plan->newsize - size;
+	}
+	*appended = false;
+	gaps[best].start += size;
+	return gaps[best].start - size;
+}
+
+// sets new offsets for all entries, old ones are kept in oldoffset
+// patched entries should have new size set, entrypatch is patchfile index for entry or -1
+static void BigfilePatchMakePlan(bigfileheader_t *data, int *entrypatch, patchfile_t *patchfiles, int num_patchfiles, int entries_new, unsigned int filesize, patchplan_t *plan)
+{
+	bigfileentry_t *entry;
+	patchrange_t *used, *gaps;
+	patchplace_t *places;
+	int i, numused, numgaps, numplaces, duplicates;
+	unsigned int headerend, end;
+	bool appended, *shared;
+
+	memset(plan, 0, sizeof(patchplan_t));
+	plan->oldsize = filesize;
+	plan->newsize = filesize;
+	headerend = 4 + (data->numentries + entries_new) * 12;
+	used = (patchrange_t *)mem_alloc(sizeof(patchrange_t) * (data->numentries + 1));
+	gaps = (patchrange_t *)mem_alloc(sizeof(patchrange_t) * (data->numentries + 2));
+	places = (patchplace_t *)mem_alloc(sizeof(patchplace_t) * (data->numentries + num_patchfiles));
+	shared = (bool *)mem_alloc(sizeof(bool) * (data->numentries + 1));
+	BigfileFindShared(data, shared, &duplicates);
+
+	// collect space that stays in use: header, untouched entries (entries to be moved
+	// are kept too since they are read from there), changed entries that fit own place
+	// and don't share it with other entries (deduplicated bigfiles)
+	numused = 0;
+	numplaces = 0;
+	used[numused].start = 0;
+	used[numused].end = headerend;
+	numused++;
+	for (i = 0; i < (int)data->numentries; i++)
+	{
+		entry = &data->entries[i];
+		entry->oldoffset = entry->offset;
+		if (entrypatch[i] >= 0 && entry->size)
+		{
+			plan->writebytes += entry->size;
+			if (entry->offset >= headerend && entry->size <= entry->oldsize && !shared[i])
+			{
+				used[numused].start = entry->offset;
+				used[numused].end = entry->offset + entry->size;
+				numused++;
+				plan->inplace++;
+				continue;
+			}
+			places[numplaces].entry = entry;
+			places[numplaces].pfile = NULL;
+			places[numplaces].size = entry->size;
+			numplaces++;
+			continue;
+		}
+		if (!entry->size)
+			continue;
+		used[numused].start = entry->offset;
+		used[numused].end = entry->offset + entry->size;
+		numused++;
+		if (entry->offset < headerend)
+		{
+			places[numplaces].entry = entry;
+			places[numplaces].pfile = NULL;
+			places[numplaces].size = entry->size;
+			numplaces++;
+			plan->displaced++;
+			plan->movebytes += entry->size;
+		}
+	}
+	for (i = 0; i < num_patchfiles; i++)
+	{
+		if (patchfiles[i].entry && !patchfiles[i].datasize)
+			plan->deleted++;
+		if (patchfiles[i].entry || !patchfiles[i].datasize)
+			continue;
+		places[numplaces].entry = NULL;
+		places[numplaces].pfile = &patchfiles[i];
+		places[numplaces].size = patchfiles[i].datasize;
+		numplaces++;
+		plan->writebytes += patchfiles[i].datasize;
+	}
+
+	// free space is everything in between
+	qsort(used, numused, sizeof(patchrange_t), PatchRangeCompare);
+	numgaps = 0;
+	end = 0;
+	for (i = 0; i < numused; i++)
+	{
+		if (used[i].start > end)
+		{
+			gaps[numgaps].start = end;
+			gaps[numgaps].end = min(used[i].start, filesize);
+			if (gaps[numgaps].end > gaps[numgaps].start)
+				numgaps++;
+		}
+		end = max(end, used[i].end);
+	}
+	if (end > plan->newsize)
+		plan->newsize = end;
+
+	// place biggest ones first
+	qsort(places, numplaces, sizeof(patchplace_t), PatchPlaceCompare);
+	for (i = 0; i < numplaces; i++)
+	{
+		if (places[i].entry)
+			places[i].entry->offset = BigfilePatchPlace(gaps, numgaps, plan, places[i].size, &appended);
+		else
+			places[i].pfile->offset = BigfilePatchPlace(gaps, numgaps, plan, places[i].size, &appended);
+		if (places[i].entry && entrypatch[places[i].entry - data->entries] < 0)
+			continue; // displaced
+		if (appended)
+			plan->appended++;
+		else
+			plan->relocated++;
+	}
+
+	mem_free(used);
+	mem_free(gaps);
+	mem_free(places);
+	mem_free(shared);
+}
+
+static void BigfilePatchPrintPlan(patchplan_t *plan)
+{
+	Print(" %6i entries written in place\n", plan->inplace);
+	Print(" %6i entries written into free space\n", plan->relocated);
+	Print(" %6i entries appended\n", plan->appended);
+	Print(" %6i entries deleted\n", plan->deleted);
+	Print(" %6i entries moved to make room for header\n", plan->displaced);
+	Print(" %i bytes to write, %i bytes to move\n", plan->writebytes, plan->movebytes);
+	Print(" file size %i -> %i\n", plan->oldsize, plan->newsize);
+}
+
+// copy data within file, ranges should not overlap
+static void BigfilePatchMove(FILE *f, unsigned int src, unsigned int dst, unsigned int size, byte *buffer, int buffersize)
+{
+	unsigned int chunk;
+
+	while(size > 0)
+	{
+		chunk = min(size, (unsigned int)buffersize);
+		if (fseek(f, (long int)src, SEEK_SET) || fread(buffer, chunk, 1, f) < 1)
+			Error("error reading data at %i (%s)", src, strerror(errno));
+		fseek(f, (long int)dst, SEEK_SET);
+		SafeWrite(f, buffer, chunk);
+		src += chunk;
+		dst += chunk;
+		size -= chunk;
+	}
+}
+
+/*
+==========================================================================================
+
+  Patch journal
+
+  before bigfile is changed in place, all bytes that are going to be overwritten are
+  saved to <bigfile>.journal; if patching is interrupted, next run restores them
+
+==========================================================================================
+*/
+
+#define BIGFILE_JOURNAL_IDENT   "BPJL"
+#define BIGFILE_JOURNAL_VERSION 1
+
+typedef struct
+{
+	char         ident[4];  // written last, journal without it was not finished
+	int          version;
+	unsigned int filesize;  // bigfile size before patching
+	int          numranges;
+	unsigned int rangescrc; // crc32 of range table
+}bigfilejournalheader_t;
+
+typedef struct
+{
+	unsigned int offset;
+	unsigned int size;
+	unsigned int crc;       // crc32 of saved data
+}bigfilejournalrange_t;
+
+static void BigfileJournalName(char *out)
+{
+	sprintf(out, "%s.journal", bigfile);
+}
+
+// make sure data has reached the disk
+static void BigfileFlushFile(FILE *f)
+{
+	fflush(f);
+#ifdef WIN32
+	_commit(_fileno(f));
+#else
+	fsync(fileno(f));
+#endif
+}
+
+static void BigfileTruncateFile(FILE *f, unsigned int size)
+{
+	fflush(f);
+#ifdef WIN32
+	if (_chsize(_fileno(f), (long)size))
+#else
+	if (ftruncate(fileno(f), (off_t)size))
+#endif
+		Error("unable to truncate %s (%s)", bigfile, strerror(errno));
+}
+
+// save contents of ranges that are going to be overwritten, ranges above filesize are not saved
+static void BigfileWriteJournal(FILE *bigf, patchrange_t *ranges, int numranges, unsigned int filesize)
+{
+	char journalfile[MAX_OSPATH];
+	bigfilejournalheader_t header;
+	bigfilejournalrange_t *jranges;
+	int i, numjranges;
+	byte *data;
+	FILE *f;
+
+	// clip ranges to old file
+	jranges = (bigfilejournalrange_t *)mem_alloc(sizeof(bigfilejournalrange_t) * max(1, numranges));
+	numjranges = 0;
+	for (i = 0; i < numranges; i++)
+	{
+		if (ranges[i].start >= filesize || ranges[i].end <= ranges[i].start)
+			continue;
+		jranges[numjranges].offset = ranges[i].start;
+		jranges[numjranges].size = min(ranges[i].end, filesize) - ranges[i].start;
+		jranges[numjranges].crc = 0;
+		numjranges++;
+	}
+
+	// write unfinished journal
+	BigfileJournalName(journalfile);
+	f = SafeOpen(journalfile, "wb");
+	memset(&header, 0, sizeof(header));
+	header.version = BIGFILE_JOURNAL_VERSION;
+	header.filesize = filesize;
+	header.numranges = numjranges;
+	SafeWrite(f, &header, sizeof(header));
+	SafeWrite(f, jranges, sizeof(bigfilejournalrange_t) * numjranges);
+	for (i = 0; i < numjranges; i++)
+	{
+		data = (byte *)mem_alloc(jranges[i].size);
+		if (fseek(bigf, (long int)jranges[i].offset, SEEK_SET) || fread(data, jranges[i].size, 1, bigf) < 1)
+			Error("error reading data at %i (%s)", jranges[i].offset, strerror(errno));
+		jranges[i].crc = crc32(data, jranges[i].size);
+		SafeWrite(f, data, jranges[i].size);
+		mem_free(data);
+	}
+
+	// finish it
+	header.rangescrc = crc32((byte *)jranges, sizeof(bigfilejournalrange_t) * numjranges);
+	fseek(f, sizeof(header), SEEK_SET);
+	SafeWrite(f, jranges, sizeof(bigfilejournalrange_t) * numjranges);
+	BigfileFlushFile(f);
+	memcpy(header.ident, BIGFILE_JOURNAL_IDENT, 4);
+	fseek(f, 0, SEEK_SET);
+	SafeWrite(f, &header, sizeof(header));
+	BigfileFlushFile(f);
+	fclose(f);
+	mem_free(jranges);
+}
+
+// patch is done, journal is not needed anymore
+static void BigfileRemoveJournal(FILE *bigf)
+{
+	char journalfile[MAX_OSPATH];
+
+	BigfileFlushFile(bigf);
+	BigfileJournalName(journalfile);
+	remove(journalfile);
+}
+
+// roll back interrupted patch if there is a journal left
+void BigfileRecoverJournal(void)
+{
+	char journalfile[MAX_OSPATH];
+	bigfilejournalheader_t header;
+	bigfilejournalrange_t *jranges;
+	byte *data;
+	FILE *f, *bigf;
+	int i;
+
+	BigfileJournalName(journalfile);
+	f = fopen(journalfile, "rb");
+	if (!f)
+		return;
+
+	// bigfile is not touched until journal is finished
+	if (fread(&header, sizeof(header), 1, f) < 1 || memcmp(header.ident, BIGFILE_JOURNAL_IDENT, 4))
+	{
+		fclose(f);
+		Warning("%s: removing unfinished patch journal, bigfile was not modified", journalfile);
+		remove(journalfile);
+		return;
+	}
+	if (header.version != BIGFILE_JOURNAL_VERSION || header.numranges < 0)
+		Error("%s: unsupported patch journal version %i", journalfile, header.version);
+	jranges = (bigfilejournalrange_t *)mem_alloc(sizeof(bigfilejournalrange_t) * max(1, header.numranges));
+	if (fread(jranges, sizeof(bigfilejournalrange_t) * header.numranges, 1, f) < 1 && header.numranges)
+		Error("%s: patch journal is damaged, unable to roll back interrupted patch", journalfile);
+	if (crc32((byte *)jranges, sizeof(bigfilejournalrange_t) * header.numranges) != header.rangescrc)
+		Error("%s: patch journal is damaged, unable to roll back interrupted patch", journalfile);
+
+	// restore saved data
+	Print("Rolling back interrupted patch of %s...\n", bigfile);
+	bigf = SafeOpen(bigfile, "rb+");
+	for (i = 0; i < header.numranges; i++)
+	{
+		data = (byte *)mem_alloc(jranges[i].size);
+		if (fread(data, jranges[i].size, 1, f) < 1 || crc32(data, jranges[i].size) != jranges[i].crc)
+			Error("%s: patch journal is damaged, unable to roll back interrupted patch", journalfile);
+		fseek(bigf, (long int)jranges[i].offset, SEEK_SET);
+		SafeWrite(bigf, data, jranges[i].size);
+		mem_free(data);
+	}
+	BigfileTruncateFile(bigf, header.filesize);
+	BigfileFlushFile(bigf);
+	fclose(bigf);
+	fclose(f);
+	mem_free(jranges);
+	remove(journalfile);
+	Print("%s restored.\n", bigfile);
+}
+
+// keep converted patch data in memory or move it to spill file
+static void BigfilePatchStore(patchfile_t *pfile, FILE **spill, int *memused, int membudget)
+{
+	if (*memused + pfile->datasize <= membudget)
+	{
+		*memused += pfile->datasize;
+		return;
+	}
+	if (!*spill)
+	{
+		*spill = tmpfile();
+		if (!*spill)
+			Error("BigFile_Patch: unable to create spill file");
+	}
+	fseek(*spill, 0, SEEK_END);
+	pfile->spillofs = ftell(*spill);
+	SafeWrite(*spill, pfile->data, pfile->datasize);
+	mem_free(pfile->data);
+	pfile->data = NULL;
+}
+
+// write patch data to current position of stream
+static void BigfilePatchWriteData(FILE *f, patchfile_t *pfile, FILE *spill, byte *buffer, int buffersize)
+{
+	FILE *src;
+
+	if (pfile->data)
+		SafeWrite(f, pfile->data, pfile->datasize);
+	else if (pfile->spillofs >= 0)
+	{
+		fseek(spill, pfile->spillofs, SEEK_SET);
+		BigfilePackCopy(f, spill, "spill file", pfile->datasize, buffer, buffersize);
+	}
+	else
+	{
+		src = SafeOpen(pfile->srcfile, "rb");
+		setvbuf(src, NULL, _IONBF, 0);
+		BigfilePackCopy(f, src, pfile->srcfile, pfile->datasize, buffer, buffersize);
+		fclose(src);
+	}
+}
+
+int BigFile_Patch(int argc, char **argv)
+{
+	char patchfile[MAX_OSPATH], outfile[MAX_OSPATH], entryname[MAX_OSPATH], convtype[1024], line[1024], *l;
+	int *entrypatch, i, num_patchfiles, max_patchfiles, linenum, linebytes, linebytes_total, progress[4], patchedbytes, patchsize_total, size, outsize, membudget, memused;
+	patchfile_t *patchfiles, *pfile;
+	byte *data, *outdata, *buffer;
+	bigfileheader_t *bigfilehead;
+	bigfileentry_t *entry;
+	int entries_new = 0, entries_changesize = 0, entries_total = 0;
+	bool overwriting, dryrun;
+	unsigned int num_entries, written_entries, ofs;
+	patchplan_t plan;
+	patchrange_t *journalranges;
+	int numjournalranges;
+	float p;
+	FILE *f, *bigf, *tmp, *spill;
+
+	if (argc < 1)
+		Error("not enough parms");
+
+	// check parms
+	strcpy(patchfile, argv[0]);
+	strcpy(outfile, bigfile);
+	progress[0] = 5;
+	progress[1] = 40;
+	progress[2] = 60;
+	progress[3] = 100;
+	dryrun = false;
+	membudget = PACK_DEFAULT_MEMBUDGET;
+	for (i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-outfile"))
+		{
+			i++; 
+			if (i < argc)
+				strcpy(outfile, argv[i]);
+			Verbose("Option: output file '%s'\n", outfile);
+			continue;
+		}
+		if (!strcmp(argv[i], "-dryrun"))
+		{
+			dryrun = true;
+			Verbose("Option: only print what is going to be done\n");
+			continue;
+		}
+		if (!strcmp(argv[i], "-membudget"))
+		{
+			i++;
+			if (i < argc)
+			{
+				membudget = max(0, atoi(argv[i]));
+				Verbose("Option: %i megabytes of converted data held in memory\n", membudget);
+			}
+			continue;
+		}
+		if (i != 0)
+			Warning("unknown parameter '%s'",  argv[i]);
+	}
+	membudget = min(membudget, 2047) * 1024 * 1024;
+
+	// first step - (0-5) preload bigfile header
+	if (strcmp(bigfile, outfile))
+	{
+		overwriting = false;
+		Verbose("Deriving patch destination (fast)\n", bigfile);
+		bigf = SafeOpen(bigfile, "rb");
+	}
+	else
+	{
+		overwriting = true;
+		Verbose("Patching destination in place\n", bigfile);
+		bigf = SafeOpen(bigfile, dryrun ? "rb" : "rb+");
+		fseek(bigf, 0, SEEK_SET);
+	}
+	Verbose("Loading %s...\n", bigfile);
+	bigfilehead = ReadBigfileHeader(bigf, false, false);
+	for (i = 0; i < (int)bigfilehead->numentries; i++)
+	{
+		entry = &bigfilehead->entries[i];
+		// show pacifier
+		p = ((float)i / (float)bigfilehead->numentries) * progress[0];
+		PercentPacifier("%i", (int)p);
+	}
+
+	// second step - load patch files
+	// raw files are only measured, they are read when written
+	Verbose("Loading patch file %s...\n", patchfile);
+	linenum = 0;
+	linebytes = 0;
+	num_patchfiles = 0;
+	max_patchfiles = 256;
+	patchfiles = (patchfile_t *)mem_alloc(sizeof(patchfile_t) * max_patchfiles);
+	entrypatch = (int *)mem_alloc(sizeof(int) * (bigfilehead->numentries + 1));
+	for (i = 0; i < (int)bigfilehead->numentries; i++)
+		entrypatch[i] = -1;
+	patchsize_total = 0;
+	memused = 0;
+	spill = NULL;
+	f = SafeOpen(patchfile, "rb");
+	linebytes_total = Q_filelength(f);
+	while(fgets(line, 1024, f))
+	{
+		linebytes += strlen(line) + 1;
+		linenum++;
+		l = line;
+		while(*l && (*l == ' ' || *l == '	'))
+			l++;
+		if (!l[0] || (l[0] == '/' && l[1] == '/')) // comment and null strings
+			continue;
+		if (!sscanf(l, "%s %s %s", &convtype, &entryname, &patchfile))
+			Error("failed to read patchfile line %i", linenum);
+		// single line
+		if (strcmp(convtype, "RAW") && strcmp(convtype, "DEL") && strcmp(convtype, "WAV2ADPCM") && strcmp(convtype, "LZ77") && strcmp(convtype, "LZ77MAX"))
+		{
+			strcpy(convtype, "RAW");
+			strcpy(patchfile, l);
+			// trim
+			while(strlen(patchfile) && (patchfile[strlen(patchfile)-1] == '\n' || patchfile[strlen(patchfile)-1] == '\r' || patchfile[strlen(patchfile)-1] == ' '))
+			{
+				i = strlen(patchfile) - 1;
+				patchfile[i] = 0;
+			}
+			// set internal name
+			ExtractFileName(patchfile, entryname);
+			// there are no .WAV files in BO, only .VAG
+			ReplaceExtension(entryname, ".wav", ".vag", "");
+		}
+		// register patchfile
+		if (num_patchfiles >= max_patchfiles)
+		{
+			max_patchfiles *= 2;
+			patchfiles = (patchfile_t *)mem_realloc(patchfiles, sizeof(patchfile_t) * max_patchfiles);
+		}
+		// find entry for patchfile
+		pfile = &patchfiles[num_patchfiles];
+		memset(pfile, 0, sizeof(patchfile_t));
+		pfile->spillofs = -1;
+		pfile->hash = BigfileEntryHashFromString(entryname, true);
+		if (!pfile->hash)
+		{
+			ExtractFileBase(entryname, convtype);
+			pfile->hash = BigfileEntryHashFromString(convtype, true);
+			if (!pfile->hash)
+				Error("cannot resolve hash on line %i", linenum);
+		}
+		pfile->entry = BigfileGetEntry(bigfilehead, pfile->hash);
+		// same entry patched again, later line wins
+		if (pfile->entry && entrypatch[pfile->entry - bigfilehead->entries] >= 0)
+		{
+			Warning("%s is patched more than once, using line %i", pfile->entry->name, linenum);
+			pfile = &patchfiles[entrypatch[pfile->entry - bigfilehead->entries]];
+			patchsize_total -= pfile->datasize;
+			if (pfile->data)
+				mem_free(pfile->data);
+			if (pfile->srcfile)
+				mem_free(pfile->srcfile);
+			pfile->srcfile = NULL;
+			pfile->data = NULL;
+			pfile->spillofs = -1;
+		}
+		else
+			num_patchfiles++;
+		// scan filetype for entry
+		if (pfile->entry && pfile->entry->size)
+			BigfileScanFiletype(bigf, pfile->entry, false, RAW_TYPE_UNKNOWN, false);
+		// get patchfile size, converting it if needed
+		if (!strcmp(convtype, "RAW"))
+		{
+			pfile->srcfile = copystring(patchfile);
+			tmp = SafeOpen(patchfile, "rb");
+			pfile->datasize = Q_filelength(tmp);
+			fclose(tmp);
+		}
+		else if (!strcmp(convtype, "DEL"))
+			pfile->datasize = 0;
+		else if (!strcmp(convtype, "WAV2ADPCM"))
+		{
+			if (!SoX_FileToData(patchfile, "--no-dither", "", "-t ima -c 1", &pfile->datasize, &pfile->data, ""))
+				Error("unable to convert %s, SoX Error on line %i\n", patchfile, linenum);
+			BigfilePatchStore(pfile, &spill, &memused, membudget);
+		}
+		else if (!strcmp(convtype, "LZ77") || !strcmp(convtype, "LZ77MAX"))
+		{
+			// decompressed map or tilemap, compress it back
+			size = LoadFile(patchfile, &data);
+			pfile->data = (byte *)LzEnc(&pfile->datasize, data, size, true, strcmp(convtype, "LZ77") ? LZ_LEVEL_MAX : LZ_LEVEL_FAST);
+			if (!pfile->data)
+				Error("unable to compress %s on line %i", patchfile, linenum);
+			// make sure it decompresses back
+			outdata = (byte *)LzDec(&outsize, pfile->data, 0, pfile->datasize, true);
+			if (!outdata || outsize != LzDecPadded(size) || memcmp(outdata, data, size))
+				Error("%s does not survive compression on line %i", patchfile, linenum);
+			Verbose("%s: compressed %i -> %i\n", patchfile, size, pfile->datasize);
+			mem_free(outdata);
+			mem_free(data);
+			BigfilePatchStore(pfile, &spill, &memused, membudget);
+		}
+		else
+			Error("bad patch filetype on line %i", linenum);
+		patchsize_total += pfile->datasize;
+		if (pfile->entry)
+			entrypatch[pfile->entry - bigfilehead->entries] = pfile - patchfiles;
+		// show pacifier
+		p = progress[0] + ((float)linebytes / (float)linebytes_total) * (progress[1] - progress[0]);
+		PercentPacifier("%i", (int)p);
+	}
+	fclose(f);
+
+	if (!num_patchfiles)
+		Error("nothing to patch");
+
+	// for optimal patching way
+	for (i = 0; i < num_patchfiles; i++)
+	{
+		pfile = &patchfiles[i];
+		if (!pfile->entry)
+			entries_new++;
+		else if (pfile->datasize != (int)pfile->entry->size)
+			entries_changesize++;
+	}
+	Verbose(" %i patch files\n", num_patchfiles);
+	Verbose(" %i new\n", entries_new);
+	Verbose(" %i changing size\n", entries_changesize);
+	if (spill)
+		Verbose(" converted data exceeds %i megabytes, some is kept in temp file\n", membudget / (1024 * 1024));
+
+	// set new sizes
+	for (i = 0; i < num_patchfiles; i++)
+	{
+		pfile = &patchfiles[i];
+		if (pfile->entry)
+		{
+			pfile->entry->oldsize = pfile->entry->size;
+			pfile->entry->size = pfile->datasize;
+		}
+	}
+
+	// patch in place - only changed entries and ones in the way of grown header are written
+	buffer = (byte *)mem_alloc(PACK_COPYBUFFER);
+	patchedbytes = 0;
+	if (overwriting)
+	{
+		ofs = Q_filelength(bigf);
+		BigfilePatchMakePlan(bigfilehead, entrypatch, patchfiles, num_patchfiles, entries_new, ofs, &plan);
+		if (dryrun)
+		{
+			Print("Patch plan for %s:\n", bigfile);
+			BigfilePatchPrintPlan(&plan);
+		}
+		else
+		{
+			Verbose("Applying patch...\n");
+			if (verbose)
+				BigfilePatchPrintPlan(&plan);
+			// save everything that is going to be overwritten
+			journalranges = (patchrange_t *)mem_alloc(sizeof(patchrange_t) * (bigfilehead->numentries + num_patchfiles + 1));
+			numjournalranges = 0;
+			journalranges[numjournalranges].start = 0;
+			journalranges[numjournalranges].end = 4 + (bigfilehead->numentries + entries_new) * 12;
+			numjournalranges++;
+			for (i = 0; i < (int)bigfilehead->numentries; i++)
+			{
+				entry = &bigfilehead->entries[i];
+				if (!entry->size || (entrypatch[i] < 0 && entry->offset == entry->oldoffset))
+					continue;
+				journalranges[numjournalranges].start = entry->offset;
+				journalranges[numjournalranges].end = entry->offset + entry->size;
+				numjournalranges++;
+			}
+			for (i = 0; i < num_patchfiles; i++)
+			{
+				pfile = &patchfiles[i];
+				if (pfile->entry || !pfile->datasize)
+					continue;
+				journalranges[numjournalranges].start = pfile->offset;
+				journalranges[numjournalranges].end = pfile->offset + pfile->datasize;
+				numjournalranges++;
+			}
+			BigfileWriteJournal(bigf, journalranges, numjournalranges, plan.oldsize);
+			mem_free(journalranges);
+			// move entries out of header's way, destinations are free space so nothing is overwritten
+			for (i = 0; i < (int)bigfilehead->numentries; i++)
+			{
+				entry = &bigfilehead->entries[i];
+				if (entrypatch[i] >= 0 || !entry->size || entry->offset == entry->oldoffset)
+					continue;
+				BigfilePatchMove(bigf, entry->oldoffset, entry->offset, entry->size, buffer, PACK_COPYBUFFER);
+				patchedbytes += entry->size;
+				p = progress[1] + ((float)patchedbytes / (float)(plan.writebytes + plan.movebytes)) * (progress[3] - progress[1]);
+				PercentPacifier("%i", (int)p);
+			}
+			// write changed entries
+			for (i = 0; i < num_patchfiles; i++)
+			{
+				pfile = &patchfiles[i];
+				if (!pfile->datasize)
+					continue;
+				fseek(bigf, pfile->entry ? pfile->entry->offset : pfile->offset, SEEK_SET);
+				BigfilePatchWriteData(bigf, pfile, spill, buffer, PACK_COPYBUFFER);
+				patchedbytes += pfile->datasize;
+				p = progress[1] + ((float)patchedbytes / (float)(plan.writebytes + plan.movebytes)) * (progress[3] - progress[1]);
+				PercentPacifier("%i", (int)p);
+			}
+			// header goes last, so it never points to data not written yet
+			num_entries = bigfilehead->numentries + entries_new;
+			fseek(bigf, 0, SEEK_SET);
+			SafeWrite(bigf, &num_entries, 4);
+			for (i = 0; i < (int)bigfilehead->numentries; i++)
+			{
+				entry = &bigfilehead->entries[i];
+				SafeWrite(bigf, &entry->hash, 4);
+				SafeWrite(bigf, &entry->size, 4);
+				SafeWrite(bigf, &entry->offset, 4);
+			}
+			for (i = 0; i < num_patchfiles; i++)
+			{
+				pfile = &patchfiles[i];
+				if (pfile->entry)
+					continue;
+				SafeWrite(bigf, &pfile->hash, 4);
+				SafeWrite(bigf, &pfile->datasize, 4);
+				SafeWrite(bigf, &pfile->offset, 4);
+			}
+			BigfileRemoveJournal(bigf);
+		}
+	}
+	else if (dryrun)
+	{
+		for (i = 0; i < (int)bigfilehead->numentries; i++)
+			patchedbytes += bigfilehead->entries[i].size;
+		for (i = 0; i < num_patchfiles; i++)
+			if (!patchfiles[i].entry)
+				patchedbytes += patchfiles[i].datasize;
+		Print("Patch plan for %s:\n", outfile);
+		Print(" new bigfile of %i bytes is written\n", 4 + (bigfilehead->numentries + entries_new) * 12 + patchedbytes);
+	}
+	else
+	{
+		Verbose("Applying extended patch...\n");
+		tmp = bigf;
+		bigf = SafeOpen(outfile, "wb");
+		setvbuf(bigf, NULL, _IOFBF, PACK_WRITEBUFFER);
+		Verbose("Patching %s...\n", bigfile);
+		// recalc offsets
+		BigfileHeaderRecalcOffsets(bigfilehead, entries_new);
+		// write new bigfile header
+		num_entries = bigfilehead->numentries + entries_new;
+		fseek(bigf, 0, SEEK_SET);
+		SafeWrite(bigf, &num_entries, 4);
+		for (i = 0; i < (int)bigfilehead->numentries; i++)
+		{
+			entry = &bigfilehead->entries[i];
+			SafeWrite(bigf, &entry->hash, 4);
+			SafeWrite(bigf, &entry->size, 4);
+			SafeWrite(bigf, &entry->offset, 4);
+			ofs = entry->size + entry->offset;
+		}
+		for (i = 0; i < num_patchfiles; i++)
+		{
+			pfile = &patchfiles[i];
+			if (pfile->entry)
+				continue;
+			SafeWrite(bigf, &pfile->hash, 4);
+			SafeWrite(bigf, &pfile->datasize, 4);
+			SafeWrite(bigf, &ofs, 4);
+			ofs += pfile->datasize;
+		}
+		// write entries
+		written_entries = 0;
+		for (i = 0; i < (int)bigfilehead->numentries; i++)
+		{
+			entry = &bigfilehead->entries[i];
+			if (!entry->size)
+				continue;
+			if (entrypatch[i] >= 0)
+				BigfilePatchWriteData(bigf, &patchfiles[entrypatch[i]], spill, buffer, PACK_COPYBUFFER);
+			else
+			{
+				if (fseek(tmp, (long int)entry->oldoffset, SEEK_SET))
+					Error("error seeking for data on file %.8X", entry->hash);
+				BigfilePackCopy(bigf, tmp, bigfile, entry->size, buffer, PACK_COPYBUFFER);
+			}
+			written_entries++;
+			// show pacifier
+			p = progress[1] + ((float)written_entries / (float)num_entries) * (progress[3] - progress[1]);
+			PercentPacifier("%i", (int)p);
+
+		}
+		for (i = 0; i < num_patchfiles; i++)
+		{
+			pfile = &patchfiles[i];
+			if (!pfile->datasize || pfile->entry)
+				continue;
+			BigfilePatchWriteData(bigf, pfile, spill, buffer, PACK_COPYBUFFER);
+			written_entries++;
+			// show pacifier
+			p = progress[1] + ((float)written_entries / (float)num_entries) * (progress[3] - progress[1]);
+			PercentPacifier("%i", (int)p);
+		}
+		Verbose("Ending patch...\n", bigfile);
+		fclose(tmp);
+
+	}
+	fclose(bigf);
+	PacifierEnd();
+	mem_free(buffer);
+	if (spill)
+		fclose(spill);
+
+	// free patch files
+	for (i = 0; i < num_patchfiles; i++)
+	{
+		pfile = &patchfiles[i];
+		if (pfile->data)
+			mem_free(pfile->data);
+		if (pfile->srcfile)
+			mem_free(pfile->srcfile);
+	}
+	mem_free(patchfiles);
+	mem_free(entrypatch);
+
+	FreeBigfileHeader(bigfilehead);
+	Print("done.\n");
+
+	return 0;
+
+}
+
+/*
+==========================================================================================
+
+  Serve
+
+  keeps bigfile header and detected types loaded and answers requests from stdin
+  requests and responses are JSON objects, one per line:
+   {"id":1,"cmd":"list"}
+   {"id":2,"cmd":"info","entry":"#0AD312F4"}
+   {"id":3,"cmd":"extract","entry":"#0AD312F4","out":"c:/0AD312F4.tga","format":"tga","options":"-t -l"}
+   {"cmd":"quit"}
+  responses go to original stdout, all other printing is moved to stderr
+
+==========================================================================================
+*/
+
+#define SERVE_MAX_LINE    4096
+#define SERVE_MAX_OPTIONS 32
+
+// get value of key from single-level JSON object, strings are unescaped
+static bool ServeJsonValue(char *line, char *key, char *out, int outsize)
+{
+	char pattern[128], *c, *p;
+	int len;
+
+	// skip matches that are not keys, like string values equal to key name
+	sprintf(pattern, "\"%s\"", key);
+	for (c = strstr(line, pattern); c; c = strstr(c, pattern))
+	{
+		for (p = c - 1; p >= line && (*p == ' ' || *p == '\t'); p--);
+		c += strlen(pattern);
+		if (p < line || (*p != '{' && *p != ','))
+			continue;
+		while(*c == ' ' || *c == '\t')
+			c++;
+		if (*c == ':')
+			break;
+	}
+	if (!c)
+		return false;
+	c++;
+	while(*c == ' ' || *c == '\t')
+		c++;
+	len = 0;
+	if (*c == '"')
+	{
+		for (c++; *c && *c != '"' && len < outsize - 1; c++)
+		{
+			if (*c == '\\' && c[1])
+				c++;
+			out[len++] = *c;
+		}
+	}
+	else
+	{
+		for (; *c && *c != ',' && *c != '}' && *c != ' ' && *c != '\r' && *c != '\n' && len < outsize - 1; c++)
+			out[len++] = *c;
+	}
+	out[len] = 0;
+	return true;
+}
+
+// write string as JSON string
+static void ServeJsonString(FILE *f, char *str)
+{
+	fputc('"', f);
+	for (; *str; str++)
+	{
+		if (*str == '"' || *str == '\\')
+			fputc('\\', f);
+		fputc(*str, f);
+	}
+	fputc('"', f);
+}
+
+static void ServeJsonEntry(FILE *f, bigfileentry_t *entry)
+{
+	fprintf(f, "\"hash\":\"%.8X\",\"name\":", entry->hash);
+	ServeJsonString(f, entry->name);
+	fprintf(f, ",\"type\":\"%s\",\"size\":%u,\"offset\":%u", UnparseBigentryType(entry->type), entry->size, entry->offset);
+}
+
+static void ServeError(FILE *f, char *id, char *error)
+{
+	fprintf(f, "{\"id\":%s,\"ok\":false,\"error\":", id);
+	ServeJsonString(f, error);
+	fprintf(f, "}\n");
+}
+
+// find entry by #hash, hashed name or name given by scanner
+static bigfileentry_t *ServeFindEntry(bigfileheader_t *data, char *name)
+{
+	unsigned int hash;
+	int i;
+
+	hash = BigfileEntryHashFromString(name, false);
+	if (hash)
+		return BigfileGetEntry(data, hash);
+	for (i = 0; i < (int)data->numentries; i++)
+		if (!stricmp(data->entries[i].name, name))
+			return &data->entries[i];
+	return NULL;
+}
+
+// BigFile_ExtractEntry fails with Error() on unwritable output or broken entry data,
+// so these are checked first and reported as failed request, returns false with error set
+static bool ServeCheckExtract(FILE *f, bigfileentry_t *entry, char *format, char *outfile, char *error)
+{
+	char path[MAX_OSPATH];
+	tim_image_t *tim;
+	rawinfo_t rawinfo;
+	byte *data, *dec;
+	int k, pos, decsize, result;
+	bool existed;
+	FILE *test;
+
+	// output could be written
+	ExtractFilePath(outfile, path);
+	if (path[0] && !TryCreatePath(path))
+	{
+		sprintf(error, "unable to create path %s: %s", path, strerror(errno));
+		return false;
+	}
+	test = fopen(outfile, "rb");
+	existed = test ? true : false;
+	if (test)
+		fclose(test);
+	test = fopen(outfile, "ab");
+	if (!test)
+	{
+		sprintf(error, "unable to write %s: %s", outfile, strerror(errno));
+		return false;
+	}
+	fclose(test);
+	if (!existed)
+		remove(outfile);
+	if (!stricmp(format, "raw"))
+		return true;
+
+	// entry data could be decoded
+	error[0] = 0;
+	data = BigfileGetContents(f, entry);
+	switch(entry->type)
+	{
+		case BIGENTRY_TIM:
+			for (k = 0, pos = 0; k < entry->timlayers && !error[0]; k++)
+			{
+				tim = TIM_LoadFromBuffer(data + pos, entry->size - pos);
+				if (tim->error)
+					sprintf(error, "broken TIM layer %i: %s", k, tim->error);
+				else
+					pos += tim->filelen;
+				FreeTIM(tim);
+			}
+			break;
+		case BIGENTRY_TILEMAP:
+			dec = (byte *)LzDec(&decsize, data, 0, entry->size, true);
+			if (!dec)
+			{
+				strcpy(error, "unable to decompress tilemap");
+				break;
+			}
+			tim = TIM_LoadFromBuffer(dec, decsize);
+			if (tim->error)
+				sprintf(error, "broken tilemap: %s", tim->error);
+			FreeTIM(tim);
+			mem_free(dec);
+			break;
+		case BIGENTRY_SPRITE:
+			memcpy(&rawinfo, &entry->rawinfo, sizeof(rawinfo_t));
+			result = RawExtractTest(data, entry->size, &rawinfo, RAW_TYPE_UNKNOWN);
+			if (result < 0)
+				sprintf(error, "broken sprite: %s", RawStringForResult(result));
+			break;
+		case BIGENTRY_MAP:
+			if (LzDecSize(data, 0, entry->size, true) != sizeof(bo_map_t))
+				strcpy(error, "map does not decompress to map size");
+			break;
+		default:
+			break;
+	}
+	BigfileReleaseContents(data);
+	return error[0] ? false : true;
+}
+
+int BigFile_Serve(int argc, char **argv)
+{
+	bigfileheader_t *data;
+	bigfileentry_t *entry, extractentry;
+	char line[SERVE_MAX_LINE], value[64], id[132], cmd[64], name[MAX_OSPATH], outfile[MAX_OSPATH], format[64], options[1024], error[MAX_OSPATH + 128];
+	char *extractargv[SERVE_MAX_OPTIONS + 2], *c;
+	int i, k, extractargc, requests;
+	FILE *f, *out;
+
+	// load header and detect types once
+	f = SafeOpen(bigfile, "rb");
+	BigfileOpenView(f);
+	data = ReadBigfileHeader(f, false, false);
+	BigfileScanFiletypes(f, data, true, NULL, RAW_TYPE_UNKNOWN);
+
+	// keep stdout for responses only
+	fflush(stdout);
+#ifdef WIN32
+	out = _fdopen(_dup(_fileno(stdout)), "w");
+	_dup2(_fileno(stderr), _fileno(stdout));
+#else
+	out = fdopen(dup(fileno(stdout)), "w");
+	dup2(fileno(stderr), fileno(stdout));
+#endif
+	if (!out)
+		Error("BigFile_Serve: unable to reopen stdout");
+	Print("serving %s, %i entries\n", bigfile, data->numentries);
+
+	requests = 0;
+	while(fgets(line, sizeof(line), stdin))
 	{
-		linebytes += strlen(line) + 1;
-		linenum++;
-		l = line;
-		while(*l && (*l == ' ' || *l == '	'))
-			l++;
-		if (!l[0] || (l[0] == '/' && l[1] == '/')) // comment and null strings
+		// echo id back, numbers as is and anything else as string
+		if (!ServeJsonValue(line, "id", value, sizeof(value)) || !value[0])
+			strcpy(id, "null");
+		else if (value[strspn(value, "-0123456789")])
+		{
+			k = 0;
+			id[k++] = '"';
+			for (c = value; *c; c++)
+			{
+				if (*c == '"' || *c == '\\')
+					id[k++] = '\\';
+				id[k++] = *c;
+			}
+			id[k++] = '"';
+			id[k] = 0;
+		}
+		else
+			strcpy(id, value);
+		if (!ServeJsonValue(line, "cmd", cmd, sizeof(cmd)))
+		{
+			if (line[0] != '\n' && line[0] != '\r')
+				ServeError(out, id, "no cmd");
+			fflush(out);
 			continue;
-		if (!sscanf(l, "%s %s %s", &convtype, &entryname, &patchfile))
-			Error("failed to read patchfile line %i", linenum);
-		// single line
-		if (strcmp(convtype, "RAW") && strcmp(convtype, "DEL") && strcmp(convtype, "WAV2ADPCM"))
+		}
+		requests++;
+
+		// all entries
+		if (!strcmp(cmd, "list"))
 		{
-			strcpy(convtype, "RAW");
-			strcpy(patchfile, l);
-			// trim
-			while(strlen(patchfile) && (patchfile[strlen(patchfile)-1] == '\n' || patchfile[strlen(patchfile)-1] == '\r' || patchfile[strlen(patchfile)-1] == ' '))
+			fprintf(out, "{\"id\":%s,\"ok\":true,\"entries\":[", id);
+			for (i = 0; i < (int)data->numentries; i++)
 			{
-				i = strlen(patchfile) - 1;
-				patchfile[i] = 0;
+				fprintf(out, (i > 0) ? ",{" : "{");
+				ServeJsonEntry(out, &data->entries[i]);
+				fprintf(out, "}");
 			}
-			// set internal name
-			ExtractFileName(patchfile, entryname);
-			// there are no .WAV files in BO, only .VAG
-			ReplaceExtension(entryname, ".wav", ".vag", "");
+			fprintf(out, "]}\n");
 		}
-		// register patchfile and preload them
-		if (num_patchfiles >= MAX_PATCHFILES)
-			Error("MAX_PATCHFILES = %i exceeded, consider increase", MAX_PATCHFILES);
-		// find entry for patchfile
-		pfile = &patchfiles[num_patchfiles];
-		pfile->hash = BigfileEntryHashFromString(entryname, true);
-		if (!pfile->hash)
+		// single entry
+		else if (!strcmp(cmd, "info") || !strcmp(cmd, "extract"))
 		{
-			ExtractFileBase(entryname, convtype);
-			pfile->hash = BigfileEntryHashFromString(convtype, true);
-			if (!pfile->hash)
-				Error("cannot resolve hash on line %i", linenum);
+			if (!ServeJsonValue(line, "entry", name, sizeof(name)))
+			{
+				ServeError(out, id, "no entry");
+				fflush(out);
+				continue;
+			}
+			entry = ServeFindEntry(data, name);
+			if (!entry)
+				ServeError(out, id, "entry not found");
+			else if (!strcmp(cmd, "info"))
+			{
+				fprintf(out, "{\"id\":%s,\"ok\":true,", id);
+				ServeJsonEntry(out, entry);
+				fprintf(out, "}\n");
+			}
+			else if (!ServeJsonValue(line, "out", outfile, sizeof(outfile)) || !outfile[0])
+				ServeError(out, id, "no out");
+			else if (!entry->size)
+				ServeError(out, id, "empty entry");
+			else
+			{
+				// format is given or picked from out file extension
+				if (!ServeJsonValue(line, "format", format, sizeof(format)))
+					ExtractFileExtension(outfile, format);
+				if (!BigfileFormatSupported(entry->type, format))
+				{
+					ServeError(out, id, "format is not supported for this entry");
+					fflush(out);
+					continue;
+				}
+				// options are passed as command-line parameters
+				extractargc = 0;
+				extractargv[extractargc++] = "-f";
+				extractargv[extractargc++] = format;
+				if (ServeJsonValue(line, "options", options, sizeof(options)))
+				{
+					for (c = strtok(options, " \t"); c && extractargc < SERVE_MAX_OPTIONS + 2; c = strtok(NULL, " \t"))
+						extractargv[extractargc++] = c;
+				}
+				// extraction may alter entry (VAG and tilemap sizes), so loaded header is kept intact
+				memcpy(&extractentry, entry, sizeof(bigfileentry_t));
+				if (!ServeCheckExtract(f, &extractentry, format, outfile, error))
+					ServeError(out, id, error);
+				else if (!BigFile_ExtractEntry(extractargc, extractargv, f, &extractentry, outfile))
+					ServeError(out, id, "sound conversion failed");
+				else
+				{
+					fprintf(out, "{\"id\":%s,\"ok\":true,\"out\":", id);
+					ServeJsonString(out, outfile);
+					fprintf(out, "}\n");
+				}
+			}
 		}
-		pfile->entry = BigfileGetEntry(bigfilehead, pfile->hash);
-		// scan filetype for entry
-		if (pfile->entry && pfile->entry->size)
-			BigfileScanFiletype(bigf, pfile->entry, false, RAW_TYPE_UNKNOWN, false);
-		//load patchfile
-		if (!strcmp(convtype, "RAW"))
-			pfile->datasize = LoadFile(patchfile, &pfile->data);
-		else if (!strcmp(convtype, "DEL"))
-			pfile->datasize = 0;
-		else if (!strcmp(convtype, "WAV2ADPCM"))
+		else if (!strcmp(cmd, "quit"))
 		{
-			if (!SoX_FileToData(patchfile, "--no-dither", "", "-t ima -c 1", &pfile->datasize, &pfile->data, ""))
-				Error("unable to convert %s, SoX Error on line %i\n", patchfile, linenum);
+			fprintf(out, "{\"id\":%s,\"ok\":true}\n", id);
+			fflush(out);
+			break;
 		}
 		else
-			Error("bad patch filetype on line %i", linenum);
-		if (!pfile->data)
-			Error("patchfile has no data on line %i", linenum);
-		patchsize_total += pfile->datasize;
-		num_patchfiles++;
-		// for optimal patching way
-		if (!pfile->entry)
-			entries_new++;
-		else if (pfile->datasize != pfile->entry->size)
-			entries_changesize++;
-		// show pacifier
-		p = progress[0] + ((float)linebytes / (float)linebytes_total) * (progress[1] - progress[0]);
-		PercentPacifier("%i", (int)p);
+			ServeError(out, id, "unknown cmd");
+		fflush(out);
 	}
+	Print("%i requests served\n", requests);
+
+	fclose(out);
+	FreeBigfileHeader(data);
+	BigfileCloseView(f);
 	fclose(f);
+	return 0;
+}
 
-	if (!num_patchfiles)
-		Error("nothing to patch");
+/*
+==========================================================================================
 
-	Verbose(" %i patch files\n", num_patchfiles);
-	Verbose(" %i new\n", entries_new);
-	Verbose(" %i changing size\n", entries_changesize);
+  Verify
 
-	// most simple patch - if size is not changed
-	patchedbytes = 0;
-	if (!entries_new && !entries_changesize && !strcmp(bigfile, outfile))
+  checks header against file bounds, finds overlapping entries and computes CRC32 of
+  all entries, which could be saved to manifest or compared with previously saved one
+
+==========================================================================================
+*/
+
+typedef struct
+{
+	bigfileheader_t *data;
+	FILE            *file;
+	bigfileview_t   *view;
+	void            *mutex;
+	bool            *valid; // entry lies within file
+	unsigned int    *crcs;
+}verifyjobs_t;
+
+static void BigFile_VerifyJob(int i, void *jobsdata)
+{
+	verifyjobs_t *jobs = (verifyjobs_t *)jobsdata;
+	bigfileentry_t *entry;
+	byte *contents;
+
+	entry = &jobs->data->entries[i];
+	if (!jobs->valid[i] || !entry->size)
 	{
-		Verbose("Applying simple patch...\n");
-		for (i = 0; i < num_patchfiles; i++)
-		{
-			pfile = &patchfiles[i];
-			fseek(bigf, pfile->entry->offset, SEEK_SET);
-			fwrite(pfile->data, pfile->datasize, 1, bigf);
-			patchedbytes += pfile->datasize;
-			// show pacifier
-			p = progress[1] + ((float)patchedbytes / (float)patchsize_total) * (progress[3] - progress[1]);
-			PercentPacifier("%i", (int)p);
-		}
+		jobs->crcs[i] = 0;
+		return;
 	}
-	else
+	Pacifier("checksumming entry %i of %i...", i + 1, jobs->data->numentries);
+
+	// mapped file is read directly, stream reads are serialized
+	if (jobs->view)
 	{
-		Verbose("Applying extended patch...\n");
-		// copy out pillbig
-		if (!overwriting)
+		jobs->crcs[i] = crc32(jobs->view->data + entry->offset, entry->size);
+		return;
+	}
+	Thread_LockMutex(jobs->mutex);
+	contents = BigfileGetContents(jobs->file, entry);
+	Thread_UnlockMutex(jobs->mutex);
+	jobs->crcs[i] = crc32(contents, entry->size);
+	BigfileReleaseContents(contents);
+}
+
+// check entry CRC's against manifest, returns number of errors
+static int BigfileVerifyManifest(char *filename, bigfileheader_t *data, unsigned int *crcs)
+{
+	bigfileentry_t *entry;
+	char line[256];
+	unsigned int hash, size, crc;
+	bool *listed;
+	int i, linenum, errors;
+	FILE *f;
+
+	f = SafeOpen(filename, "r");
+	listed = (bool *)mem_alloc(sizeof(bool) * (data->numentries + 1));
+	memset(listed, 0, sizeof(bool) * (data->numentries + 1));
+	errors = 0;
+	linenum = 0;
+	while(fgets(line, sizeof(line), f))
+	{
+		linenum++;
+		if (!line[0] || line[0] == '#' || line[0] == '\n')
+			continue;
+		if (sscanf(line, "%X %u %X", &hash, &size, &crc) != 3)
 		{
-			tmp = bigf;
-			bigf = SafeOpen(outfile, "wb");
+			Warning("%s: bad line %i", filename, linenum);
+			errors++;
+			continue;
 		}
-		else
+		entry = BigfileGetEntry(data, hash);
+		if (!entry)
 		{
-			Verbose("Buffering %s...\n", bigfile);
-			fseek(bigf, 0, SEEK_SET);
-			linebytes = 0;
-			linebytes_total = Q_filelength(bigf);
-			tmp = tmpfile();
-			while(linebytes < linebytes_total)
-			{
-				chunkbytes = min(linebytes_total - linebytes, chunksize);
-				fread(chunkdata, chunkbytes, 1, bigf);
-				fwrite(chunkdata, chunkbytes, 1, tmp);
-				linebytes += chunkbytes;
-				// show pacifier
-				p = progress[2] + ((float)linebytes / (float)linebytes_total) * (progress[3] - progress[2]);
-				PercentPacifier("%i", (int)p);
-			}
+			Warning("entry %.8X is missing", hash);
+			errors++;
+			continue;
 		}
-		Verbose("Patching %s...\n", bigfile);
-		// set new sizes
-		for (i = 0; i < num_patchfiles; i++)
+		i = entry - data->entries;
+		listed[i] = true;
+		if (entry->size != size)
 		{
-			pfile = &patchfiles[i];
-			if (pfile->entry)
-			{
-				pfile->entry->size = pfile->datasize;
-				pfile->entry->data = pfile->data;
-			}
+			Warning("entry %.8X: size is %u, should be %u", hash, entry->size, size);
+			errors++;
 		}
-		// recalc offsets
-		BigfileHeaderRecalcOffsets(bigfilehead, entries_new);
-		// write new bigfile header
-		num_entries = bigfilehead->numentries + entries_new;
-		fseek(bigf, 0, SEEK_SET);
-		SafeWrite(bigf, &num_entries, 4);
-		for (i = 0; i < (int)bigfilehead->numentries; i++)
+		else if (crcs[i] != crc)
 		{
-			entry = &bigfilehead->entries[i];
-			SafeWrite(bigf, &entry->hash, 4);
-			SafeWrite(bigf, &entry->size, 4);
-			SafeWrite(bigf, &entry->offset, 4);
-			ofs = entry->size + entry->offset;
+			Warning("entry %.8X: CRC mismatch", hash);
+			errors++;
 		}
-		for (i = 0; i < num_patchfiles; i++)
+	}
+	fclose(f);
+	for (i = 0; i < (int)data->numentries; i++)
+	{
+		if (listed[i])
+			continue;
+		Warning("entry %.8X is not in manifest", data->entries[i].hash);
+		errors++;
+	}
+	mem_free(listed);
+	return errors;
+}
+
+int BigFile_Verify(int argc, char **argv)
+{
+	bigfileheader_t *data;
+	bigfileentry_t *entry;
+	bigfilespan_t *spans;
+	verifyjobs_t jobs;
+	char manifest[MAX_OSPATH], savemanifest[MAX_OSPATH];
+	unsigned int numentries, read[3], headerend, end;
+	int i, filesize, numspans, endspan, errors, shared, unused;
+	FILE *f, *mf;
+
+	// check parms
+	manifest[0] = 0;
+	savemanifest[0] = 0;
+	for (i = 0; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-manifest"))
 		{
-			pfile = &patchfiles[i];
-			if (pfile->entry)
-				continue;
-			SafeWrite(bigf, &pfile->hash, 4);
-			SafeWrite(bigf, &entry->size, 4);
-			SafeWrite(bigf, &ofs, 4);
-			ofs += entry->size;
+			i++;
+			if (i < argc)
+			{
+				strlcpy(manifest, argv[i], sizeof(manifest));
+				Verbose("Option: compare with manifest %s\n", manifest);
+			}
+			continue;
 		}
-		// write entries
-		written_entries = 0;
-		for (i = 0; i < (int)bigfilehead->numentries; i++)
+		if (!strcmp(argv[i], "-savemanifest"))
 		{
-			entry = &bigfilehead->entries[i];
-			if (!entry->size)
-				continue;
-			if (entry->data)
-				SafeWrite(bigf, entry->data, entry->size);
-			else
+			i++;
+			if (i < argc)
 			{
-				if (entry->size > PILL_BIG_BIGGEST_ENTRY)
-					Error("PILL_BIG_BIGGEST_ENTRY = %i exceeded, consider increasing", PILL_BIG_BIGGEST_ENTRY);
-				if (fseek(tmp, (long int)entry->oldoffset, SEEK_SET))
-					Error("error seeking for data on file %.8X", entry->hash);
-				if (fread(chunkdata, entry->size, 1, tmp) < 1)
-					Error("error reading data on file %.8X (%s)", entry->hash, strerror(errno));
-				SafeWrite(bigf, chunkdata, entry->size);
+				strlcpy(savemanifest, argv[i], sizeof(savemanifest));
+				Verbose("Option: save manifest to %s\n", savemanifest);
 			}
-			written_entries++;
-			// show pacifier
-			if (overwriting)
-				p = progress[2] + ((float)written_entries / (float)num_entries) * (progress[3] - progress[2]);
-			else
-				p = progress[1] + ((float)written_entries / (float)num_entries) * (progress[3] - progress[1]);
-			PercentPacifier("%i", (int)p);
+			continue;
+		}
+		if (Thread_ParseOption(argc, argv, &i))
+			continue;
+		Warning("unknown parameter '%s'",  argv[i]);
+	}
 
+	// read header as is, ReadBigfileHeader would stop on first broken entry
+	Verbose("Loading %s...\n", bigfile);
+	f = SafeOpen(bigfile, "rb");
+	filesize = Q_filelength(f);
+	if (fread(&numentries, sizeof(unsigned int), 1, f) < 1)
+		Error("%s: unable to read header", bigfile);
+	if (numentries == 0 || numentries > (unsigned int)(filesize - 4) / 12)
+		Error("%s: header does not fit file (%u entries)", bigfile, numentries);
+	headerend = 4 + numentries * 12;
+	data = (bigfileheader_t *)mem_alloc(sizeof(bigfileheader_t));
+	data->hashindex = NULL;
+	data->numentries = numentries;
+	data->entries = (bigfileentry_t *)mem_alloc(numentries * sizeof(bigfileentry_t));
+	for (i = 0; i < (int)numentries; i++)
+	{
+		entry = &data->entries[i];
+		BigfileEmptyEntry(entry);
+		if (fread(&read, 12, 1, f) < 1)
+			Error("%s: unable to read header", bigfile);
+		entry->hash = read[0];
+		entry->size = read[1];
+		entry->offset = read[2];
+	}
+	BigfileIndexHeader(data);
+
+	// check entries
+	errors = 0;
+	jobs.valid = (bool *)mem_alloc(sizeof(bool) * numentries);
+	spans = (bigfilespan_t *)mem_alloc(sizeof(bigfilespan_t) * numentries);
+	numspans = 0;
+	for (i = 0; i < (int)numentries; i++)
+	{
+		entry = &data->entries[i];
+		jobs.valid[i] = false;
+		if (!entry->hash)
+		{
+			Warning("entry %i: null hash", i + 1);
+			errors++;
 		}
-		for (i = 0; i < num_patchfiles; i++)
+		else if (BigfileGetEntry(data, entry->hash) != entry)
 		{
-			pfile = &patchfiles[i];
-			if (!pfile->datasize || pfile->entry)
-				continue;
-			SafeWrite(bigf, pfile->data, pfile->datasize);
-			written_entries++;
-			// show pacifier
-			if (overwriting)
-				p = progress[2] + ((float)written_entries / (float)num_entries) * (progress[3] - progress[2]);
-			else
-				p = progress[1] + ((float)written_entries / (float)num_entries) * (progress[3] - progress[1]);
-			PercentPacifier("%i", (int)p);
+			Warning("entry %i: hash %.8X is used more than once", i + 1, entry->hash);
+			errors++;
 		}
-		Verbose("Ending patch...\n", bigfile);
-		fclose(tmp);
+		if (!entry->size)
+			continue;
+		if (entry->offset < headerend)
+		{
+			Warning("entry %.8X: data is inside header", entry->hash);
+			errors++;
+			continue;
+		}
+		if (entry->offset > (unsigned int)filesize || entry->size > (unsigned int)filesize - entry->offset)
+		{
+			Warning("entry %.8X: data is out of file bounds", entry->hash);
+			errors++;
+			continue;
+		}
+		jobs.valid[i] = true;
+		spans[numspans].offset = entry->offset;
+		spans[numspans].size = entry->size;
+		spans[numspans].entry = i;
+		numspans++;
+	}
 
+	// find overlaps, entries of deduplicated bigfile share exactly same data
+	qsort(spans, numspans, sizeof(bigfilespan_t), BigfileSpanCompare);
+	shared = 0;
+	unused = 0;
+	end = headerend;
+	endspan = -1; // span that reaches furthest, the one overlapped
+	for (i = 0; i < numspans; i++)
+	{
+		if (spans[i].offset > end)
+			unused += spans[i].offset - end;
+		else if (i > 0 && spans[i].offset == spans[i - 1].offset && spans[i].size == spans[i - 1].size)
+			shared++;
+		else if (spans[i].offset < end)
+		{
+			Warning("entry %.8X overlaps entry %.8X", data->entries[spans[i].entry].hash, data->entries[spans[endspan].entry].hash);
+			errors++;
+		}
+		if (spans[i].offset + spans[i].size > end)
+		{
+			end = spans[i].offset + spans[i].size;
+			endspan = i;
+		}
 	}
-	fclose(bigf);
+	unused += filesize - end;
+	mem_free(spans);
+
+	// checksum entries
+	jobs.data = data;
+	jobs.file = f;
+	jobs.view = BigfileOpenView(f);
+	jobs.mutex = Thread_CreateMutex();
+	jobs.crcs = (unsigned int *)mem_alloc(sizeof(unsigned int) * numentries);
+	if (numthreads > 1)
+		Verbose("checksumming with %i threads\n", numthreads);
+	Thread_RunJobs(numentries, BigFile_VerifyJob, &jobs);
+	Thread_DestroyMutex(jobs.mutex);
 	PacifierEnd();
 
-	// free patch files
-	for (i = 0; i < num_patchfiles; i++)
+	// compare with manifest
+	if (manifest[0])
+		errors += BigfileVerifyManifest(manifest, data, jobs.crcs);
+
+	// save manifest
+	if (savemanifest[0])
 	{
-		pfile = &patchfiles[num_patchfiles];
-		if (pfile->data)
-			mem_free(pfile->data);
+		mf = SafeOpenWrite(savemanifest);
+		fprintf(mf, "# %s: hash size crc32\n", bigfile);
+		for (i = 0; i < (int)numentries; i++)
+			fprintf(mf, "%.8X %u %.8X\n", data->entries[i].hash, data->entries[i].size, jobs.crcs[i]);
+		WriteClose(mf);
+		Print("wrote %s\n", savemanifest);
 	}
 
-	FreeBigfileHeader(bigfilehead);
-	Print("done.\n");
-
-	return 0;
+	Print("%u entries, %i shared, %i bytes unused\n", numentries, shared, unused);
+	if (errors)
+		Print("%i errors found\n", errors);
+	else
+		Print("bigfile is OK\n");
 
+	mem_free(jobs.crcs);
+	mem_free(jobs.valid);
+	FreeBigfileHeader(data);
+	BigfileCloseView(f);
+	fclose(f);
+	return errors ? 1 : 0;
 }
 
 /*
@@ -5430,9 +8109,18 @@ int BigFile_Main(int argc, char **argv)
 			i++;
 			continue;
 		}
+		if (!strcmp(argv[i], "-nocache"))
+		{
+			usedetectcache = false;
+			i++;
+			continue;
+		}
 		break;
 	}
 
+	// bigfile could be left half-patched
+	BigfileRecoverJournal();
+
 	// load up knowledge base
 	// FIXME: stupid code, rewrite
 	bigklist = NULL;
@@ -5460,6 +8148,10 @@ int BigFile_Main(int argc, char **argv)
 		returncode = BigFile_Pack(argc-i-1, argv+i+1);
 	else if (!strcmp(argv[i], "-patch"))
 		returncode = BigFile_Patch(argc-i-1, argv+i+1);
+	else if (!strcmp(argv[i], "-serve"))
+		returncode = BigFile_Serve(argc-i-1, argv+i+1);
+	else if (!strcmp(argv[i], "-verify"))
+		returncode = BigFile_Verify(argc-i-1, argv+i+1);
 	else if (!strcmp(argv[i], "-version"))
 		returncode = BigFile_Version(argc-i-1, argv+i+1);
 	else
@@ -2,6 +2,7 @@
 #include "timfile.h"
 #include "rawfile.h"
 #include "vagfile.h"
+#include "adpcmfile.h"
 #include "mapfile.h"
 #include "filter.h"
 #include "omnilib/dpspr32file.h"
@@ -56,6 +57,7 @@ typedef struct
 	unsigned int size; // file size
 	unsigned int offset; // file offset
 	unsigned int oldoffset; // old file offset (before recalculating)
+	unsigned int oldsize; // old file size (before patching)
 
 	// loaded by tool
 	char name[MAX_OSPATH];
@@ -73,6 +75,12 @@ typedef struct
 	// for RAW files (assigned by known-files-list)
 	rawinfo_t rawinfo;
 
+	// source files info, saved by incremental packing
+	int srctime;
+	unsigned int srcsize;
+	unsigned int srccrc;
+	unsigned int srcparms; // checksum of listfile conversion settings
+
 	// only presented if loaded
 	byte *data; 
 }
@@ -83,6 +91,7 @@ typedef struct
 {
 		bigfileentry_t *entries;
 		unsigned int	numentries;
+		hashindex_t    *hashindex; // hash -> entry
 }
 bigfileheader_t;
 
@@ -102,23 +111,43 @@ typedef struct
 {
 	int numentries;
 	bigkentry_t *entries;
+	hashindex_t *hashindex; // hash -> kentry
 }
 bigklist_t;
 
 extern bigklist_t *bigklist;
 
+// memory-mapped bigfile
+typedef struct bigfileview_s
+{
+	FILE          *file;  // stream this view was made for
+	byte          *data;  // whole file contents
+	size_t         size;
+#ifdef WIN32
+	HANDLE         mapping;
+#endif
+	struct bigfileview_s *next;
+}
+bigfileview_t;
+
 // base functions
 bigklist_t *BigfileLoadKList(char *filename, bool loadDefault);
 unsigned int BigfileEntryHashFromString(char *string, bool casterror);
 bigfileentry_t *BigfileGetEntry(bigfileheader_t *bigfile, unsigned int hash);
+void BigfileIndexHeader(bigfileheader_t *bigfile);
 bigfileheader_t *ReadBigfileHeader(FILE *f, bool loadfilecontents, bool hashnamesonly);
 void FreeBigfileHeader(bigfileheader_t *bigfile);
 void BigfileSeekContents(FILE *f, byte *contents, bigfileentry_t *entry);
+bigfileview_t *BigfileOpenView(FILE *f);
+bigfileview_t *BigfileGetView(FILE *f);
+void BigfileCloseView(FILE *f);
+byte *BigfileGetContents(FILE *f, bigfileentry_t *entry);
+void BigfileReleaseContents(byte *contents);
 void BigfileScanFiletype(FILE *f, bigfileentry_t *entry, bool scanraw, rawtype_t forcerawtype, bool allow_auto_naming);
 void BigfileScanFiletypes(FILE *f, bigfileheader_t *data, bool scanraw, list_t *ixlist, rawtype_t forcerawtype);
 void BigFile_ExtractRawImage(int argc, char **argv, char *outfile, bigfileentry_t *entry, rawblock_t *rawblock, char *format);
-void BigFile_ExtractSound(int argc, char **argv, char *outfile, bigfileentry_t *entry, char *infileformat, int defaultinputrate, char *format);
-void BigFile_ExtractEntry(int argc, char **argv, FILE *bigfile, bigfileentry_t *entry, char *outfile);
+bool BigFile_ExtractSound(int argc, char **argv, char *outfile, bigfileentry_t *entry, char *infileformat, int defaultinputrate, char *format);
+bool BigFile_ExtractEntry(int argc, char **argv, FILE *bigfile, bigfileentry_t *entry, char *outfile);
 
 // convert functions
 void TGAfromTIM(FILE *bigf, bigfileentry_t *entry, char *outfile, bool bpp16to24, bool bpp8to32, bool keep_palette, imgfilter_t scaler, float colorscale, int colorsub);
@@ -23,6 +23,8 @@
 #include "bloodpill.h"
 #include "soxsupp.h"
 #include "zlib.h"
+#include "vorbis.h"
+#include "thread.h"
 
 // global switches
 bool waitforkey;
@@ -38,6 +40,7 @@ char progpath[MAX_OSPATH];
 
 // bigfile.c
 int BigFile_Main(int argc, char **argv);
+int BigfilePackSelfTest(void);
 
 // timfile.c
 int Targa2Tim_Main(int argc, char **argv);
@@ -57,6 +60,7 @@ int Script_Main(int argc, char **argv);
 
 // mapfile.c
 int MapConvert_Main(int argc, char **argv);
+int LzSelfTest(void);
 
 void Print(char *str, ...)
 {
@@ -181,6 +185,7 @@ int Help_Main()
 	"    -cd x: change current dir to this\n"
 	"    -sp : print percentage pacifier as newlines, used by installers\n"
 	"    -errlog: write berror.txt on error\n"
+	"    -threads x: number of worker threads (0 = number of CPUs)\n"
 	"\n"
 	"1.3 Action list:\n"
 	"----------------------------------------\n"
@@ -191,6 +196,7 @@ int Help_Main()
 	"    -adpcmconvert: convert a Blood Omen raw ADPCM file to WAV/OGG (see ch.6)\n"
 	"    -mapconvert: convert a Blood Omen map to TGA picture (see ch.7)\n"
 	"    -raw: convert other Blood Omen internal format images (see ch.8)\n"
+	"    -selftest: run builtin self-checks of LZ77 encoder and incremental packing\n"
 	"\n"
 	"2.1 Operating with bigfile:\n"
 	"----------------------------------------\n"
@@ -199,6 +205,7 @@ int Help_Main()
 	"    Command: one of bigfile commands (see ch.2.3)\n"
 	"    Parameters:\n"
 	"      -klist file: optional, path to known-file-list file\n"
+	"      -nocache: do not use or write filetype detection cache (bigfilename.cache)\n"
 	"\n"
 	"2.2 Known-file-list:\n"
 	"----------------------------------------\n"
@@ -217,6 +224,8 @@ int Help_Main()
 	"    -patch script: patch bigfile\n"
 	"    -extract filename: extract single entry from bigfile\n"
 	"    -version: measure bigfile version and return as ERRORLEVEL\n"
+	"    -verify: check bigfile integrity\n"
+	"    -serve: answer requests from stdin\n"
 	"\n"
 	"2.3.1 List bigfile contents:\n"
 	"----------------------------------------\n"
@@ -231,15 +240,18 @@ int Help_Main()
 	"    Dir: optional output directory (default is bigfile)\n"
 	"    Parameters:\n"
 	"      -hashasnames: use hashed names instead of trying to unhash them\n"
+	"      -threads x: unpack entries with x threads (0 = number of CPUs)\n"
 	"      -tim2tga: converts all TIM files to Targa images\n"
 	"      -16to24: when write TGA, convert 16 bit colors 24 bit\n"
 	"               including colormaps, useful because not many tools\n"
 	"               supports support for 16 Bit TGA's\n"
 	"      -adpcm2wav: convert raw ADPCM to native ADPCM wave\n"
-	"      -adpcm2pcm: convert raw ADPCM to PCM wave\n"
+	"      -adpcm2pcm: convert raw ADPCM to PCM wave (builtin, no SoX needed)\n"
 	"      -adpcm2ogg: convert raw ADPCM to Ogg Vorbis (quality 5)\n"
+	"                  (builtin if libvorbis is found, no SoX needed)\n"
 	"      -vag2pcm: convert VAG to PCM wave\n"
 	"      -vag2ogg: convert VAG to Ogg Vorbis (quality 5)\n"
+	"                (builtin if libvorbis is found, no SoX needed)\n"
 	"      -raw2tga: convert raw images to readable TGA\n"
 	"                WARNING: a lot of files will be extracted! (about 45000)\n"
 	"                TIP: unlike TIM->TGA, this is one way raw conversion\n"
@@ -257,9 +269,16 @@ int Help_Main()
 	"\n"
 	"2.3.3 Pack bigfile\n"
 	"----------------------------------------\n"
-	"    Usage: bpill -bigfile bigfilename -pack dir\n"
+	"    Usage: bpill -bigfile bigfilename -pack dir parameters\n"
 	"    Bigfilename: this bigfile will be created/overwritten (optional, see 2.1)\n"
 	"    Dir: optional input directory, default is bigfile\n"
+	"    Parameters:\n"
+	"      -threads x: convert entries with x threads (0 = number of CPUs)\n"
+	"      -membudget x: megabytes of converted data kept in memory, rest goes to temp file (default 256)\n"
+	"      -incremental: save source files time/size/crc to listfile.txt and only convert\n"
+	"         entries which sources are changed since last incremental pack, others\n"
+	"         are copied from existing bigfile\n"
+	"      -dedup: entries with identical contents share single copy of data\n"
 	"\n"
 	"2.3.4 Patch bigfile\n"
 	"----------------------------------------\n"
@@ -267,17 +286,27 @@ int Help_Main()
 	"    Scriptname: a text file that must consist of such lines:\n"
 	"       RAW filename_or_hash path_to_input_file : replace a raw file\n"
 	"       WAV2ADPCM filename_or_hash path_to_input_file : replace a speech\n"
+	"       LZ77 filename_or_hash path_to_input_file : compress and replace a map or tilemap\n"
+	"       LZ77MAX filename_or_hash path_to_input_file : same as LZ77, slower but smaller\n"
 	"       DEL filename_or_hash : delete file\n"
 	"       path_to_input_file : replace a raw file (shoul matchunhashed file name);\n"
 	"       See samples/patch/ folder for an example of patch script\n"
+	"    Bigfile is patched in place with a journal, if patching gets interrupted\n"
+	"    it is rolled back on next run\n"
 	"    Parameters:\n"
 	"      -outfile filename: generate a new bigfile insted of modifying existing\n"
+	"      -dryrun: only print how much data is going to be written and moved\n"
+	"      -membudget x: megabytes of converted data kept in memory, rest goes to temp file (default 256)\n"
 	"\n"
 	"2.3.5 Extract entry from bigfile\n"
 	"----------------------------------------\n"
 	"    Usage: bpill -bigfile bigfilename -extract filename outfile parameters\n"
 	"    Filename: #hash or file name of entry inside bigfile\n"
 	"    Outfile: path of output file\n"
+	"    Several entries could be extracted at once, Filename is then a wildcard\n"
+	"    (sound/*.adpcm), $type or @listfile with names, #hashes, wildcards or $types\n"
+	"    listed one per line. Outfile is then output directory, entries are extracted\n"
+	"    to TGA/WAV by their type unless -f is set. Accepts -threads x\n"
 	"    Parameters:\n"
 	"      -f format: the format what output file you want, default is estimated\n"
 	"               from outfile extension. If outfile has no extension,\n"
@@ -334,6 +363,26 @@ int Help_Main()
 	"     0 - bigfile is PlayStation bigfile\n"
 	"    -1 - bigfile is PC bigfile\n"
 	"    -2 - bigfile is PC Sneak Peek preview bigfile\n"
+	"\n"
+	"2.3.7 Verify bigfile\n"
+	"    Usage: bpill -bigfile bigfilename -verify parameters\n"
+	"    Checks that all entries are within file and do not overlap, computes CRC32\n"
+	"    of every entry. Returns ERRORLEVEL 1 if any problems found\n"
+	"    Parameters:\n"
+	"      -manifest filename: compare entry sizes and CRC's with manifest\n"
+	"      -savemanifest filename: save entry sizes and CRC's to manifest\n"
+	"      -threads x: checksum with x threads (0 = number of CPUs)\n"
+	"\n"
+	"2.3.8 Serve requests\n"
+	"    Usage: bpill -bigfile bigfilename -serve\n"
+	"    Loads bigfile once and answers requests read from stdin, one JSON object\n"
+	"    per line. Responses are written to stdout as JSON lines, messages go to stderr\n"
+	"    Requests:\n"
+	"      {\"id\":1,\"cmd\":\"list\"} : list all entries\n"
+	"      {\"id\":2,\"cmd\":\"info\",\"entry\":\"#hash\"} : entry info\n"
+	"      {\"id\":3,\"cmd\":\"extract\",\"entry\":\"#hash\",\"out\":\"file.tga\",\"format\":\"tga\",\"options\":\"-t -l\"}\n"
+	"         extract entry, format and options are same as for -extract\n"
+	"      {\"cmd\":\"quit\"} : stop serving\n"
 	"----------------------------------------\n"
 	"3.1 Convert JAM movie to TGA files\n"
 	"----------------------------------------\n"
@@ -368,7 +417,7 @@ int Help_Main()
 	"    Outfile: optional name of output file\n"
 	"    Parameters:\n"
 	"      -rate X: ADPCM sampling rate, defaults to 22050\n"
-	"      -pcm: make 16-bit PCM wavefile\n"
+	"      -pcm: make 16-bit PCM wavefile (builtin, no SoX needed)\n"
 	"      -oggvorbis: make Ogg Vorbis files (Quality 5)\n"
 	"      -custom: custom SoX output options (see SoX docs)\n"
 	"\n"
@@ -433,6 +482,32 @@ int Help_Main()
 	return 0;
 }
 
+/*
+==========================================================================================
+
+  Self-checks
+
+==========================================================================================
+*/
+
+int SelfTest_Main()
+{
+	int failed;
+
+	failed = 0;
+	Print("Testing LZ77 encoder...\n");
+	failed += LzSelfTest();
+	Print("Testing incremental packing...\n");
+	failed += BigfilePackSelfTest();
+	if (failed)
+	{
+		Print("%i self-checks failed\n", failed);
+		return 1;
+	}
+	Print("all self-checks passed\n");
+	return 0;
+}
+
 /*
 ==========================================================================================
 
@@ -514,6 +589,8 @@ int main(int argc, char **argv)
 			errorlog = true;
 			continue;
 		}
+		if (Thread_ParseOption(argc, argv, &i))
+			continue;
 		if (!strcmp(argv[i],"-testcmd"))
 		{
 			printf("Commandline parms test:\n");
@@ -535,6 +612,7 @@ int main(int argc, char **argv)
 	// init SoX library
 	SoX_Init(customsoxpath);
 	PK3_OpenLibrary(false);
+	Vorbis_OpenLibrary(false);
 
 	// print caption
 	if (printcap)
@@ -552,6 +630,10 @@ int main(int argc, char **argv)
 			Print("Zlib found\n");
 		else
 			Print("Zlib not found\n");
+		if (Vorbis_Enabled())
+			Print("Vorbis found\n");
+		else
+			Print("Vorbis not found\n");
 		Print( "\n" );
 	}
 
@@ -585,6 +667,8 @@ int main(int argc, char **argv)
 		returncode = MapConvert_Main(argc-i, argv+i);
 	else if (!strcmp (argv[i], "-help"))
 		returncode = Help_Main();
+	else if (!strcmp (argv[i], "-selftest"))
+		returncode = SelfTest_Main();
 	else
 		Error("unknown action %s, try %s -help", argv[i], progname);
 	Print("\n");
@@ -592,6 +676,7 @@ int main(int argc, char **argv)
 	// free allocated memory
 	Mem_Shutdown();
 	PK3_CloseLibrary();
+	Vorbis_CloseLibrary();
 
 #if _MSC_VER
 	if (waitforkey)
@@ -13,6 +13,7 @@
 
 #include "mem.h"
 #include "bloodpill.h"
+#include "thread.h"
 
 // set these before calling CheckParm
 int myargc;
@@ -142,6 +143,93 @@ void ListAdd(list_t *list, const char *str, unsigned char x)
 	list->items++;
 }
 
+/*
+=================
+Hash index
+=================
+*/
+
+hashindex_t *NewHashIndex(int maxitems)
+{
+	hashindex_t *index;
+	int i;
+
+	index = (hashindex_t *)mem_alloc(sizeof(hashindex_t));
+	memset(index, 0, sizeof(hashindex_t));
+	// keep load factor at most 0.5
+	index->slots = 16;
+	index->shift = 28;
+	while(index->slots < maxitems * 2)
+	{
+		index->slots <<= 1;
+		index->shift--;
+	}
+	index->maxitems = maxitems;
+	index->keys = (unsigned int *)mem_alloc(index->slots * sizeof(unsigned int));
+	index->values = (int *)mem_alloc(index->slots * sizeof(int));
+	for (i = 0; i < index->slots; i++)
+		index->values[i] = -1;
+	return index;
+}
+
+void FreeHashIndex(hashindex_t *index)
+{
+	if (!index)
+		return;
+	mem_free(index->keys);
+	mem_free(index->values);
+	mem_free(index);
+}
+
+void HashIndexAdd(hashindex_t *index, unsigned int key, int value)
+{
+	int i;
+
+	if (index->items >= index->maxitems)
+		Error("HashIndexAdd: index overflow (%i items)", index->maxitems);
+	i = (int)((key * 0x9E3779B1u) >> index->shift);
+	while(index->values[i] >= 0)
+		i = (i + 1) & (index->slots - 1);
+	index->keys[i] = key;
+	index->values[i] = value;
+	index->items++;
+}
+
+// returns item number or -1 if not found
+// if slot is given, it should be set to -1 before first call, next calls will return next items with same key
+int HashIndexFind(hashindex_t *index, unsigned int key, int *slot)
+{
+	int i;
+
+	if (slot && *slot >= 0)
+		i = (*slot + 1) & (index->slots - 1);
+	else
+		i = (int)((key * 0x9E3779B1u) >> index->shift);
+	for (; index->values[i] >= 0; i = (i + 1) & (index->slots - 1))
+	{
+		if (index->keys[i] != key)
+			continue;
+		if (slot)
+			*slot = i;
+		return index->values[i];
+	}
+	return -1;
+}
+
+// case-insensitive string hash (FNV-1a)
+unsigned int HashString(const char *str)
+{
+	unsigned int hash;
+
+	hash = 2166136261u;
+	while(*str)
+	{
+		hash ^= (unsigned char)tolower(*str++);
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
 /*
 =================
 Error
@@ -266,9 +354,15 @@ CreatePath
 */
 void CreatePath (char *path)
 {
-	char *ofs, save, *opath;
+	if (!TryCreatePath(path))
+		Error ("CreatePath '%s': %s", path, strerror(errno));
+}
+
+// same as CreatePath, but returns false on failure
+bool TryCreatePath (char *path)
+{
+	char *ofs, save;
 
-	opath = path;
 	for (ofs = path+1 ; *ofs ; ofs++)
 	{
 		if (*ofs == '/' || *ofs == '\\')
@@ -279,17 +373,20 @@ void CreatePath (char *path)
 			if (path[0] && path[strlen(path)-1] != ':')
 			{
 				#if defined(WIN32) || defined(_WIN64)
-				  if (mkdir (path) != -1)
+				  if (mkdir (path) == -1)
 				#else
-				  if (mkdir (path, 0777) != -1)
+				  if (mkdir (path, 0777) == -1)
 				#endif
-					return;
-				if (errno != EEXIST)
-					Error ("CreatePath '%s': %s", opath, strerror(errno));
+					if (errno != EEXIST)
+					{
+						*ofs = save;
+						return false;
+					}
 			}
 			*ofs = save;
 		}
 	}
+	return true;
 }
 
 /*
@@ -326,17 +423,19 @@ TempFileName
 get temp directory
 ============
 */
+// names are unique within process, so several threads could get temp files at once
+volatile int tempfilenum = 0;
+
 void TempFileName(char *out)
 {
-	char tempdir[MAX_OSPATH], tempfile[MAX_OSPATH];
+	char tempdir[MAX_OSPATH];
 	int l;
 
 #ifdef WIN32
 	l = GetTempPath(MAX_OSPATH, tempdir);
-	tmpnam(tempfile);
 	if (!l)
 		Error("TempFileName: error %s", strerror(GetLastError()));
-	sprintf(out, "%s%s", tempdir, tempfile);
+	sprintf(out, "%sbpill%u_%i.tmp", tempdir, (unsigned int)GetCurrentProcessId(), Thread_AtomicIncrement(&tempfilenum));
 #else
 	Error("TempFileName: only implemented on Win32\n");
 #endif
@@ -984,6 +1083,20 @@ int ReadSignedByte(byte *buffer)
 	return (signed char)buffer[0];
 }
 
+void WriteUInt(byte *buffer, unsigned int val)
+{
+	buffer[0] = val & 0xFF;
+	buffer[1] = (val >> 8) & 0xFF;
+	buffer[2] = (val >> 16) & 0xFF;
+	buffer[3] = (val >> 24) & 0xFF;
+}
+
+void WriteUShort(byte *buffer, unsigned int val)
+{
+	buffer[0] = val & 0xFF;
+	buffer[1] = (val >> 8) & 0xFF;
+}
+
 #ifdef _SGI_SOURCE
 #define	__BIG_ENDIAN__
 #endif
@@ -1193,6 +1306,12 @@ void crc32_init()
 }
 
 unsigned int crc32(unsigned char *block, unsigned int length)
+{
+   return crc32_update(0, block, length);
+}
+
+// continue CRC of data split to several blocks, start with 0
+unsigned int crc32_update(unsigned int crcvalue, unsigned char *block, unsigned int length)
 {
    register unsigned long crc;
    unsigned long i;
@@ -1200,7 +1319,7 @@ unsigned int crc32(unsigned char *block, unsigned int length)
    if (!crc_initialized)
 	   crc32_init();
 
-   crc = 0xFFFFFFFF;
+   crc = crcvalue ^ 0xFFFFFFFF;
    for (i = 0; i < length; i++)
    {
       crc = ((crc >> 8) & 0x00FFFFFF) ^ crc_tab[(crc ^ *block++) & 0xFF];
@@ -41,6 +41,23 @@ list_t *NewList();
 void FreeList(list_t *list);
 void ListAdd(list_t *list, const char *str, unsigned char x);
 
+// hash index, maps unsigned int keys to item numbers
+// open addressing with linear probing, items with same key are found in order they were added
+typedef struct hashindex_s
+{
+	int           slots; // power of two
+	int           shift;
+	int           items;
+	int           maxitems;
+	unsigned int *keys;
+	int          *values; // -1 is empty slot
+}hashindex_t;
+hashindex_t *NewHashIndex(int maxitems);
+void FreeHashIndex(hashindex_t *index);
+void HashIndexAdd(hashindex_t *index, unsigned int key, int value);
+int HashIndexFind(hashindex_t *index, unsigned int key, int *slot);
+unsigned int HashString(const char *str);
+
 // set these before calling CheckParm
 extern int myargc;
 extern char **myargv;
@@ -64,6 +81,7 @@ void TempFileName(char *out);
 extern void	Q_mkdir (char *path);
 
 void CreatePath (char *path);
+bool TryCreatePath (char *path);
 void ChangeDirectory (char *path);
 void GetDirectory(char *path, int size_bytes);
 void GetRealPath(char *outpath, char *inpath);
@@ -112,6 +130,8 @@ unsigned int ReadUInt(byte *buffer);
 unsigned int ReadUShort(byte *buffer);
 int ReadShort(byte *buffer);
 int ReadSignedByte(byte *buffer);
+void WriteUInt(byte *buffer, unsigned int val);
+void WriteUShort(byte *buffer, unsigned int val);
 
 void StartTokenParsing (char *data);
 bool GetToken (bool crossline);
@@ -122,6 +142,7 @@ extern void CRC_ProcessByte(unsigned short *crcvalue, byte data);
 extern unsigned short CRC_Value(unsigned short crcvalue);
 
 unsigned int crc32(unsigned char *block, unsigned int length);
+unsigned int crc32_update(unsigned int crcvalue, unsigned char *block, unsigned int length);
 
 extern void COM_CreatePath (char *path);
 
@@ -98,99 +98,498 @@ typedef struct bo_render_light_s
 
 // read decompressed LZ77 stream
 // thanks to Ben Lincoln for that function
-#define LZ_MAX_ITERATIONS 4096000
+// stream is LZSS with 4096 bytes window: each flag byte (read from lower bit) codes 8 commands,
+// set bit is a literal byte, cleared one is a 2-byte pair of 12-bit window offset and 4-bit length (+3)
+// original decoder always emits one byte more reading over end of stream, this is kept
+// as it could affect padded output size
 #define LZ_MAX_OUTPUT 1048576
-byte lzbuf[LZ_MAX_OUTPUT];
-void *LzDec(int *outbufsize, byte *inbuf, int startpos, int buflen, bool leading_filesize)
-{
-	int filesize;
-	bool done = false;
-	int numIterations, bytesWritten;
-	unsigned short tempIndex, command;
-	short offset;
-	byte length, currentByte, currentByte1, currentByte2;
-	byte tempBuffer[4114];
-	int i;
+#define LZ_WINDOW     4096
+#define LZ_WINDOWMASK (LZ_WINDOW - 1)
+#define LZ_WINDOWSTART 4078
 
-	// compare file size
+// returns padded size of decompressed data, -1 on error
+static int LzDecStart(byte *inbuf, int *startpos, int buflen, bool leading_filesize)
+{
 	if (buflen < 8)
-		return NULL;
+		return -1;
 	if (leading_filesize)
 	{
-		filesize = ReadUInt(inbuf) + 4;
-		startpos = 4;
-		if (filesize != buflen)
-			return NULL;
+		if ((int)(ReadUInt(inbuf) + 4) != buflen)
+			return -1;
+		*startpos = 4;
 	}
+	if (*startpos < 0 || *startpos > buflen)
+		return -1;
+	return 0;
+}
 
-	// initialize decompressor
-	tempIndex = 4078;
-	numIterations = 0;
-	bytesWritten = 0;
-    command = 0;
-    for (i = 0; i < 4078; i++)
-		tempBuffer[i] = 0x20;
+// padded size of decompressed data
+int LzDecPadded(int size)
+{
+	// playstation files apparently need to be multiples of 1024 bytes in size
+	if ((size % 1024) > 0)
+		size = size + 1024 - (size % 1024);
+	return size;
+}
 
-	// decompress
-	#define readByte() inbuf[startpos]; startpos++;	
-	#define tempInc(b) tempBuffer[tempIndex] = b; tempIndex++; tempIndex = (unsigned short)(tempIndex % 4096);
-	#define outByte(b) lzbuf[bytesWritten] = b; bytesWritten++;
-	while(!done)
-    {
-		// handle errors
-		if (numIterations > LZ_MAX_ITERATIONS)
-			return NULL;
-		if (bytesWritten > LZ_MAX_OUTPUT)
-			return NULL;
-		if (startpos > buflen)
-			return NULL;
-
-		// read command and process it
-		command = (unsigned short)(command >> 1);
-		if ((command & 0x0100) == 0)
+// get size of decompressed data without decompressing
+int LzDecSize(byte *inbuf, int startpos, int buflen, bool leading_filesize)
+{
+	int written, flags, bit;
+
+	if (LzDecStart(inbuf, &startpos, buflen, leading_filesize) < 0)
+		return -1;
+	written = 0;
+	while(1)
+	{
+		if (startpos >= buflen)
+			break;
+		flags = inbuf[startpos++];
+		for (bit = 0; bit < 8; bit++, flags >>= 1)
+		{
+			if (flags & 1)
+			{
+				if (startpos >= buflen)
+					goto done;
+				startpos++;
+				written++;
+			}
+			else
+			{
+				if (startpos + 2 > buflen)
+					goto done;
+				written += (inbuf[startpos + 1] & 0x0F) + 3;
+				startpos += 2;
+			}
+		}
+		if (written > LZ_MAX_OUTPUT)
+			return -1;
+	}
+done:
+	written++; // byte over end of stream
+	if (written > LZ_MAX_OUTPUT)
+		return -1;
+	return LzDecPadded(written);
+}
+
+// decompress into caller buffer, returns padded size of decompressed data
+// or -1 if stream is broken or does not fit outbufsize, padding is filled with zeroes
+// reentrant, could be used by several threads
+int LzDecBuffer(byte *outbuf, int outbufsize, byte *inbuf, int startpos, int buflen, bool leading_filesize)
+{
+	byte window[LZ_WINDOW];
+	int written, flags, bit, r, offset, length, fastend, i;
+	byte c, *out;
+
+	if (LzDecStart(inbuf, &startpos, buflen, leading_filesize) < 0)
+		return -1;
+
+	// initialize decompressor
+	memset(window, 0x20, LZ_WINDOWSTART);
+	memset(window + LZ_WINDOWSTART, 0, LZ_WINDOW - LZ_WINDOWSTART);
+	r = LZ_WINDOWSTART;
+	out = outbuf;
+	written = 0;
+
+	// whole flag group fits when there is 16 bytes of input and 8*18 bytes of output
+	fastend = outbufsize - 8*18;
+	while(1)
+	{
+		if (startpos >= buflen)
+			break;
+		flags = inbuf[startpos++];
+		if (startpos + 16 <= buflen && written <= fastend)
+		{
+			// fast path, no bounds checks
+			for (bit = 0; bit < 8; bit++, flags >>= 1)
+			{
+				if (flags & 1)
+				{
+					c = inbuf[startpos++];
+					out[written++] = c;
+					window[r] = c;
+					r = (r + 1) & LZ_WINDOWMASK;
+					continue;
+				}
+				offset = inbuf[startpos] | ((inbuf[startpos + 1] & 0xF0) << 4);
+				length = (inbuf[startpos + 1] & 0x0F) + 3;
+				startpos += 2;
+				for (i = 0; i < length; i++)
+				{
+					c = window[(offset + i) & LZ_WINDOWMASK];
+					out[written++] = c;
+					window[r] = c;
+					r = (r + 1) & LZ_WINDOWMASK;
+				}
+			}
+			continue;
+		}
+		// near end of input or output
+		for (bit = 0; bit < 8; bit++, flags >>= 1)
 		{
-			command = (unsigned short)((unsigned short)(inbuf[startpos]) | 0xFF00);
-			startpos++;
+			if (flags & 1)
+			{
+				if (startpos >= buflen)
+					goto done;
+				if (written >= outbufsize)
+					return -1;
+				c = inbuf[startpos++];
+				out[written++] = c;
+				window[r] = c;
+				r = (r + 1) & LZ_WINDOWMASK;
+				continue;
+			}
+			if (startpos + 2 > buflen)
+				goto done;
+			offset = inbuf[startpos] | ((inbuf[startpos + 1] & 0xF0) << 4);
+			length = (inbuf[startpos + 1] & 0x0F) + 3;
+			startpos += 2;
+			if (written + length > outbufsize)
+				return -1;
+			for (i = 0; i < length; i++)
+			{
+				c = window[(offset + i) & LZ_WINDOWMASK];
+				out[written++] = c;
+				window[r] = c;
+				r = (r + 1) & LZ_WINDOWMASK;
+			}
 		}
-		// command ad 0x01 - read whole next byte
-		if ((command & 0x01) == 0x01)
+	}
+done:
+	// byte over end of stream, it's contents are unknown
+	written++;
+	if (written > LZ_MAX_OUTPUT || LzDecPadded(written) > outbufsize)
+		return -1;
+	memset(out + written - 1, 0, LzDecPadded(written) - written + 1);
+	return LzDecPadded(written);
+}
+
+// decompress into newly allocated buffer, should be freed with mem_free
+void *LzDec(int *outbufsize, byte *inbuf, int startpos, int buflen, bool leading_filesize)
+{
+	int size;
+	byte *outbuf;
+
+	size = LzDecSize(inbuf, startpos, buflen, leading_filesize);
+	if (size < 0)
+		return NULL;
+	outbuf = (byte *)mem_alloc(size);
+	if (LzDecBuffer(outbuf, size, inbuf, startpos, buflen, leading_filesize) != size)
+	{
+		mem_free(outbuf);
+		return NULL;
+	}
+	*outbufsize = size;
+	return outbuf;
+}
+
+/*
+==========================================================================================
+
+ LZ77 stream encoding
+
+==========================================================================================
+*/
+
+// produces streams in the LzDec format: matches are searched through hash chains over
+// 3-byte sequences, window is prefilled same way decoder does so initial spaces could be referenced
+// last LZ_WINDOW - LZ_WINDOWSTART slots are not initialized by game decoder, so they are never
+// inserted into hash chains and could only be referenced once input has been written over them
+#define LZ_MINMATCH     3
+#define LZ_MAXMATCH     18
+#define LZ_HASHSIZE     4096
+#define LZ_HASH(p)      ((((p)[0] << 4) ^ ((p)[1] << 2) ^ (p)[2]) & (LZ_HASHSIZE - 1))
+#define LZ_CHAIN_FAST   16
+#define LZ_CHAIN_MAX    LZ_WINDOW
+
+typedef struct
+{
+	byte *buf;      // window prefill followed by input
+	int   buflen;
+	int   head[LZ_HASHSIZE];
+	int   prev[LZ_WINDOW];
+	int   inserted; // positions below are in hash chains, starts past uninitialized window slots
+	int   maxchain;
+}lzenc_t;
+
+// window offset for position in encoder buffer
+#define LZ_WINDOWOFS(pos) (((pos) - LZ_WINDOW + LZ_WINDOWSTART) & LZ_WINDOWMASK)
+// first encoder buffer position that has defined contents in game decoder window
+#define LZ_FIRSTVALID     (LZ_WINDOW - LZ_WINDOWSTART)
+
+static void LzEncInsert(lzenc_t *enc, int pos)
+{
+	int h;
+
+	for (; enc->inserted < pos; enc->inserted++)
+	{
+		if (enc->inserted + LZ_MINMATCH > enc->buflen)
+			continue;
+		h = LZ_HASH(enc->buf + enc->inserted);
+		enc->prev[enc->inserted & LZ_WINDOWMASK] = enc->head[h];
+		enc->head[h] = enc->inserted;
+	}
+}
+
+// find longest match for pos, returns match length (0 if there is none)
+static int LzEncFindMatch(lzenc_t *enc, int pos, int *matchpos)
+{
+	int cand, chain, len, maxlen, bestlen;
+	byte *cur, *src;
+
+	LzEncInsert(enc, pos);
+	maxlen = min(LZ_MAXMATCH, enc->buflen - pos);
+	if (maxlen < LZ_MINMATCH)
+		return 0;
+	cur = enc->buf + pos;
+	bestlen = 0;
+	chain = enc->maxchain;
+	// window slot of candidate is not overwritten by the time it is read if distance is not above window size
+	for (cand = enc->head[LZ_HASH(cur)]; cand >= LZ_FIRSTVALID && pos - cand <= LZ_WINDOW && chain > 0; cand = enc->prev[cand & LZ_WINDOWMASK], chain--)
+	{
+		src = enc->buf + cand;
+		if (src[bestlen] != cur[bestlen] || src[0] != cur[0])
+			continue;
+		for (len = 1; len < maxlen && src[len] == cur[len]; len++);
+		if (len > bestlen)
 		{
-			currentByte = readByte()
-			outByte(currentByte)
-			tempInc(currentByte)
-			if (startpos > buflen)
+			bestlen = len;
+			*matchpos = cand;
+			if (len == maxlen)
 				break;
 		}
-		// otherwise unpack the sequence
+	}
+	return bestlen >= LZ_MINMATCH ? bestlen : 0;
+}
+
+// code input into flag groups, returns new outpos or -1 if output does not fit
+static int LzEncStream(byte *outbuf, int outbufsize, int outpos, byte *inbuf, int inlen, int maxchain, bool lazy)
+{
+	lzenc_t *enc;
+	int pos, flagpos, flagbit, len, matchpos, nextlen, nextpos, ofs;
+
+	// set up window
+	enc = (lzenc_t *)mem_alloc(sizeof(lzenc_t));
+	enc->buflen = LZ_WINDOW + inlen;
+	enc->buf = (byte *)mem_alloc(enc->buflen);
+	memset(enc->buf, 0, LZ_WINDOW - LZ_WINDOWSTART);
+	memset(enc->buf + LZ_WINDOW - LZ_WINDOWSTART, 0x20, LZ_WINDOWSTART);
+	memcpy(enc->buf + LZ_WINDOW, inbuf, inlen);
+	memset(enc->head, -1, sizeof(enc->head));
+	enc->inserted = LZ_FIRSTVALID;
+	enc->maxchain = maxchain;
+
+	// code
+	flagpos = 0;
+	flagbit = 8;
+	pos = LZ_WINDOW;
+	while(pos < enc->buflen)
+	{
+		// flag byte + 2 bytes of pair
+		if (outpos + 3 > outbufsize)
+		{
+			outpos = -1;
+			break;
+		}
+		if (flagbit == 8)
+		{
+			flagpos = outpos++;
+			outbuf[flagpos] = 0;
+			flagbit = 0;
+		}
+		len = LzEncFindMatch(enc, pos, &matchpos);
+		// lazy matching: literal is cheaper if next position gives longer match
+		if (lazy && len && len < LZ_MAXMATCH)
+		{
+			nextlen = LzEncFindMatch(enc, pos + 1, &nextpos);
+			if (nextlen > len)
+				len = 0;
+		}
+		if (!len)
+		{
+			outbuf[flagpos] |= (1 << flagbit);
+			outbuf[outpos++] = enc->buf[pos++];
+		}
 		else
 		{
-			currentByte1 = readByte()
-			currentByte2 = readByte()
-			offset = (unsigned short)(currentByte1 | (currentByte2 & 0xF0) << 4);
-			length = (byte)((currentByte2 & 0x0F) + 3);
+			ofs = LZ_WINDOWOFS(matchpos);
+			outbuf[outpos++] = (byte)(ofs & 0xFF);
+			outbuf[outpos++] = (byte)(((ofs >> 4) & 0xF0) | (len - LZ_MINMATCH));
+			pos += len;
+		}
+		flagbit++;
+	}
+	mem_free(enc->buf);
+	mem_free(enc);
+	return outpos;
+}
+
+// compress into caller buffer, returns compressed size or -1 if it does not fit outbufsize
+// LzDec always emits one byte over end of stream and pads output to 1024 bytes, so
+// trailing zeroes of 1024-padded input are not coded and decompressed size matches inlen
+// reentrant, could be used by several threads
+int LzEncBuffer(byte *outbuf, int outbufsize, byte *inbuf, int inlen, bool leading_filesize, lzlevel_t level)
+{
+	int codelen, start, minlen, outpos;
+
+	if (inlen <= 0 || inlen > LZ_MAX_OUTPUT)
+		return -1;
+
+	// find out how much of input should be coded
+	// 1024-aligned input has to end with zero, which is byte LzDec emits over end of stream,
+	// otherwise it would decompress to next 1024 bytes
+	codelen = inlen;
+	if (!(inlen % 1024))
+	{
+		if (inbuf[inlen - 1])
+			return -1;
+		codelen = inlen - 1;
+		while(codelen > inlen - 1024 && !inbuf[codelen - 1])
+			codelen--;
+	}
+
+	start = leading_filesize ? 4 : 0;
+	outpos = LzEncStream(outbuf, outbufsize, start, inbuf, codelen, (level == LZ_LEVEL_MAX) ? LZ_CHAIN_MAX : LZ_CHAIN_FAST, level == LZ_LEVEL_MAX);
+	if (outpos < 0)
+		return -1;
+
+	// LzDec refuses buffers shorter than 8 bytes, so such tiny input is coded as plain literals
+	if (outpos < 8)
+	{
+		minlen = 8 - start - 1;
+		if (inlen < minlen)
+			return -1;
+		outpos = LzEncStream(outbuf, outbufsize, start, inbuf, max(codelen, minlen), 0, false);
+		if (outpos < 0)
+			return -1;
+	}
+	if (!leading_filesize)
+		return outpos;
+	outbuf[0] = (byte)((outpos - 4) & 0xFF);
+	outbuf[1] = (byte)(((outpos - 4) >> 8) & 0xFF);
+	outbuf[2] = (byte)(((outpos - 4) >> 16) & 0xFF);
+	outbuf[3] = (byte)(((outpos - 4) >> 24) & 0xFF);
+	return outpos;
+}
+
+// compress into newly allocated buffer, should be freed with mem_free
+void *LzEnc(int *outbufsize, byte *inbuf, int inlen, bool leading_filesize, lzlevel_t level)
+{
+	int size, maxsize;
+	byte *outbuf;
+
+	// worst case is all literals
+	maxsize = 4 + inlen + (inlen + 7) / 8 + 3;
+	outbuf = (byte *)mem_alloc(maxsize);
+	size = LzEncBuffer(outbuf, maxsize, inbuf, inlen, leading_filesize, level);
+	if (size < 0)
+	{
+		mem_free(outbuf);
+		return NULL;
+	}
+	*outbufsize = size;
+	return outbuf;
+}
+
+// walk coded stream and check that no pair references window slot that game decoder leaves
+// uninitialized before input is written over it, returns false on such reference
+static bool LzTestOffsets(byte *inbuf, int startpos, int buflen)
+{
+	bool valid[LZ_WINDOW - LZ_WINDOWSTART];
+	int flags, bit, r, offset, length, i, slot;
+
+	memset(valid, 0, sizeof(valid));
+	r = LZ_WINDOWSTART;
+	while(startpos < buflen)
+	{
+		flags = inbuf[startpos++];
+		for (bit = 0; bit < 8 && startpos < buflen; bit++, flags >>= 1)
+		{
+			if (flags & 1)
+			{
+				startpos++;
+				length = 1;
+				offset = -1;
+			}
+			else
+			{
+				if (startpos + 2 > buflen)
+					break;
+				offset = inbuf[startpos] | ((inbuf[startpos + 1] & 0xF0) << 4);
+				length = (inbuf[startpos + 1] & 0x0F) + 3;
+				startpos += 2;
+			}
 			for (i = 0; i < length; i++)
 			{
-				outByte(tempBuffer[(offset + i) % 4096])
-				if (startpos > buflen)
+				if (offset >= 0)
 				{
-					done = true;
-					break;
+					slot = (offset + i) & LZ_WINDOWMASK;
+					if (slot >= LZ_WINDOWSTART && !valid[slot - LZ_WINDOWSTART])
+						return false;
 				}
-				tempInc(tempBuffer[(offset + i) % 4096])
+				if (r >= LZ_WINDOWSTART)
+					valid[r - LZ_WINDOWSTART] = true;
+				r = (r + 1) & LZ_WINDOWMASK;
 			}
 		}
-		numIterations++;
 	}
-	#undef tempInc
-	#undef readByte
-	#undef outByte
+	return true;
+}
 
-	// playstation files apparently need to be multiples of 1024 bytes in size
-	if ((bytesWritten % 1024) > 0)
-		bytesWritten = bytesWritten + 1024 - (bytesWritten % 1024);
+// round-trip encoder on inputs starting with zero runs, returns number of failed tests
+// 1024-aligned input with nonzero last byte could not keep it's size and should be refused
+int LzSelfTest(void)
+{
+	int lens[5] = { 64, 1024, 3000, 7168, 20000 };
+	int t, level, i, inlen, enclen, declen, failed;
+	byte *in, *enc, *dec;
 
-	*outbufsize = bytesWritten;
-	return lzbuf;
+	failed = 0;
+	for (t = 0; t < 5; t++)
+	{
+		inlen = lens[t];
+		in = (byte *)mem_alloc(inlen);
+		memset(in, 0, inlen);
+		// leading zeroes are followed by repeating pattern, spaces and another zero run
+		for (i = min(40, inlen / 2); i < inlen; i++)
+			in[i] = (i % 97 < 60) ? (byte)((i * 7) % 13) : ((i % 97 < 80) ? 0x20 : 0);
+		for (level = LZ_LEVEL_FAST; level <= LZ_LEVEL_MAX; level++)
+		{
+			enc = (byte *)LzEnc(&enclen, in, inlen, true, (lzlevel_t)level);
+			if (!(inlen % 1024) && in[inlen - 1])
+			{
+				if (enc)
+				{
+					Print("LZ test %i/%i: input that could not keep it's size is encoded\n", inlen, level);
+					mem_free(enc);
+					failed++;
+				}
+				continue;
+			}
+			if (!enc)
+			{
+				Print("LZ test %i/%i: encoding failed\n", inlen, level);
+				failed++;
+				continue;
+			}
+			if (!LzTestOffsets(enc, 4, enclen))
+			{
+				Print("LZ test %i/%i: uninitialized window slot referenced\n", inlen, level);
+				failed++;
+			}
+			dec = (byte *)LzDec(&declen, enc, 0, enclen, true);
+			if (!dec || declen != LzDecPadded(inlen) || memcmp(dec, in, inlen))
+			{
+				Print("LZ test %i/%i: round-trip mismatch\n", inlen, level);
+				failed++;
+			}
+			if (dec)
+				mem_free(dec);
+			mem_free(enc);
+		}
+		mem_free(in);
+	}
+	return failed;
 }
 
 /*
@@ -668,6 +1067,11 @@ static cachepic_t *CachePic(char *entryname)
 					Print("failed (null entry)\n");
 					entry = NULL;
 				}
+				else if (BigfileGetView(cachepic_bigfile))
+				{
+					// mapped bigfile
+					filedata = BigfileGetContents(cachepic_bigfile, entry);
+				}
 				else
 				{
 					filedata = (byte *)mem_alloc(entry->size);
@@ -831,9 +1235,11 @@ static cachepic_t *CachePic(char *entryname)
 		}
 		else
 			Print("failed (not a TIM)\n");
+		if (dec != filedata)
+			mem_free(dec);
 	}
 	FreeRawBlock(rawblock);
-	mem_free(filedata);
+	BigfileReleaseContents(filedata);
 
 	// write into array
 	pic = &cachedpics[e];
@@ -890,20 +1296,24 @@ void FreePic(cachepic_t *cachepic)
 int MapScan(byte *buffer, int filelen)
 {
 	byte *dec;
-	int decSize;
+	int decSize, m;
 
-	// map or tile are compressed, decompress it
-	dec = (byte *)LzDec(&decSize, buffer, 0, filelen, true);
-	if (dec == NULL)
+	// map or tile are compressed, check decompressed size first
+	decSize = LzDecSize(buffer, 0, filelen, true);
+	if (decSize < 0)
 		return 0;
 	// maps are dumped structs and have fixed file length
 	if (decSize == sizeof(bo_map_t))
 		return 1;
 	// tiles are just compressed reqular TIM's
-	if (dec[0] == 16 && dec[1] == 0 && dec[2] == 0 && dec[2] == 0)
-		return 2;
+	dec = (byte *)mem_alloc(decSize);
+	m = 0;
+	if (LzDecBuffer(dec, decSize, buffer, 0, filelen, true) == decSize)
+		if (dec[0] == 16 && dec[1] == 0 && dec[2] == 0 && dec[2] == 0)
+			m = 2;
+	mem_free(dec);
 	// unknown
-	return 0;
+	return m;
 }
 
 void DeveloperData(char *caption, byte *data, int per_line, int num_lines, int line_skipstart, int line_skipend, bool developer)
@@ -1833,7 +2243,7 @@ int MapExportTGA(char *mapfile, byte *fileData, int fileDataSize, char *outfile,
 	int map_mincol, map_minrow, map_maxcol, map_maxrow;
 	unsigned short tilepix, tilegroup, map_num, map_section;
 	char filename[MAX_OSPATH], path[MAX_OSPATH], mapname[32], s[256], *picname;
-	byte *dec, contents, subpic;
+	byte contents, subpic;
 	map_renderbuffer_t *map_image;
 	cachepic_t *pic;
 	float f;
@@ -1864,14 +2274,10 @@ int MapExportTGA(char *mapfile, byte *fileData, int fileDataSize, char *outfile,
 	Print("section %i\n", map_section);
 
 	// decompress
-	dec = (byte *)LzDec(&decSize, fileData, 0, fileDataSize, true);
-	if (dec == NULL)
-		return 0;
+	decSize = LzDecBuffer((byte *)&map, sizeof(bo_map_t), fileData, 0, fileDataSize, true);
 	// should have fixed size
 	if (decSize != sizeof(bo_map_t))
 		return 0;
-
-	memcpy(&map, dec, sizeof(bo_map_t));
 	map_mincol = 80;
 	map_minrow = 80;
 	map_maxcol = 0;
@@ -3507,12 +3913,9 @@ int MapExportTXT(char *mapfile, byte *fileData, int fileDataSize, char *outfile,
 	}
 
 	// decompress
-	dec = (byte *)LzDec(&decSize, fileData, 0, fileDataSize, true);
-	if (dec == NULL)
-		return 0;
+	decSize = LzDecBuffer((byte *)&map, sizeof(bo_map_t), fileData, 0, fileDataSize, true);
 	if (decSize != sizeof(bo_map_t))
 		return 0;
-	memcpy(&map, dec, sizeof(bo_map_t));
 
 	// set export path
 	sprintf(filename, "%s_sv.txt", outfile);
@@ -3853,7 +4256,6 @@ int MapAnalyze(char *mapfile, byte *fileData, int fileDataSize, char *outfile, b
 	unsigned short map_num, map_section;
 	FILE *f;
 	int i, j, decSize;
-	byte *dec;
 	bo_map_t map;
 	
 	// extract map (get mapnum and section)
@@ -3872,12 +4274,9 @@ int MapAnalyze(char *mapfile, byte *fileData, int fileDataSize, char *outfile, b
 	}
 
 	// decompress
-	dec = (byte *)LzDec(&decSize, fileData, 0, fileDataSize, true);
-	if (dec == NULL)
-		return 0;
+	decSize = LzDecBuffer((byte *)&map, sizeof(bo_map_t), fileData, 0, fileDataSize, true);
 	if (decSize != sizeof(bo_map_t))
 		return 0;
-	memcpy(&map, dec, sizeof(bo_map_t));
 
 	// u1
 	sprintf(filename, "%s_u1.csv", outfile);
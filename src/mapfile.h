@@ -363,6 +363,19 @@ typedef struct
 #define ITEM_ENDING_1           69
 #define ITEM_ENDING_2           70
 
+// LZ77 compression levels
+typedef enum
+{
+	LZ_LEVEL_FAST,          // short hash chains
+	LZ_LEVEL_MAX            // full window search with lazy matching
+}lzlevel_t;
+
 // functions
 int MapScan(byte *buffer, int filelen);
+int LzDecPadded(int size);
+int LzDecSize(byte *inbuf, int startpos, int buflen, bool leading_filesize);
+int LzDecBuffer(byte *outbuf, int outbufsize, byte *inbuf, int startpos, int buflen, bool leading_filesize);
 void *LzDec(int *outbufsize, byte *inbuf, int startpos, int buflen, bool leading_filesize);
+int LzEncBuffer(byte *outbuf, int outbufsize, byte *inbuf, int inlen, bool leading_filesize, lzlevel_t level);
+void *LzEnc(int *outbufsize, byte *inbuf, int inlen, bool leading_filesize, lzlevel_t level);
+int LzSelfTest(void);
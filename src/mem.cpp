@@ -19,7 +19,6 @@ size_t              total_active;
 size_t              total_active_peak;
 vector<memsentinel> sentinels;
 HANDLE              sentinelMutex = NULL;
-HANDLE              sentinelMutex2 = NULL;
 
 /*
 ==========================================================================================
@@ -52,7 +51,6 @@ void Mem_Init(void)
 
 	sentinels.clear();
 	sentinelMutex = CreateMutex(NULL, FALSE, NULL);
-	sentinelMutex2 = CreateMutex(NULL, FALSE, NULL);
 }
 
 void Mem_Shutdown(void)
@@ -142,7 +140,7 @@ bool _mem_sentinel_free(char *name, void *ptr, char *file, int line)
 	if (!memstats)
 		return true;
 
-	WaitForSingleObject(sentinelMutex2, INFINITE);
+	WaitForSingleObject(sentinelMutex, INFINITE);
 	// find sentinel for pointer
 	int found = -1;
 	for (std::vector<memsentinel>::iterator s = sentinels.begin(); s < sentinels.end(); s++)
@@ -169,7 +167,7 @@ bool _mem_sentinel_free(char *name, void *ptr, char *file, int line)
 			break;
 		}
 	}
-	ReleaseMutex(sentinelMutex2);
+	ReleaseMutex(sentinelMutex);
 	// oops, this pointer was not allocated
 	if (found == 1)
 		return true;
@@ -328,7 +326,7 @@ int brelease(MemBuf_t *b, void **bufferptr)
 
 // bfree()
 // free buffer and stored data
-void bfree(MemBuf_t *b, byte **bufferptr)
+void bfree(MemBuf_t *b)
 {
 	if (b->buffer)
 		mem_free(b->buffer);
@@ -33,6 +33,7 @@
 
 #include "bloodpill.h"
 #include "bigfile.h"
+#include "thread.h"
 
 // raw error messages
 char *rawextractresultstrings[13] =
@@ -1458,6 +1459,8 @@ rawblock_t *RawExtract_Type1(unsigned char *buffer, int filelen, rawinfo_t *rawi
 		Print("extracting type1\n");
 	if (buffer[0] != 1)
 		return RawErrorBlock(NULL, RAWX_ERROR_HEADER_NOT_VALID); // header not valid
+	if (filelen < 788)
+		return RawErrorBlock(NULL, RAWX_ERROR_FILE_SMALLER_THAN_REQUIRED); // shorter than header
 	if (buffer[784] > 120 || buffer[785] > 120 || buffer[784]*buffer[785] < 0)
 		return RawErrorBlock(NULL, RAWX_ERROR_WIDTH_OR_HEIGHT_NOT_VALID); // invalid width/height
 	if (forced == false && (filelen - (788 + buffer[784]*buffer[785]) > 32))
@@ -2205,6 +2208,258 @@ rawblock_t *RawExtract_Type5(byte *buffer, int filelen, rawinfo_t *rawinfo, bool
 	return rawblock;
 }
 
+/*
+==========================================================================================
+
+  TEST-ONLY VALIDATION
+
+  mirrors RawExtract_Type1..5 checks without building rawblock, returns file end pos
+  or error code, so autoscan does not allocate anything
+
+==========================================================================================
+*/
+
+typedef struct
+{
+	int offset;
+	int width;
+	int height;
+	int size;
+}rawtestchunk_t;
+
+// same as detect() of type 3-5 extractors, returns number of objects which fit
+static int RawTestDetect(byte *buffer, int filelen, rawtestchunk_t *chunks, int numobjects, bool decompress255, bool halfres)
+{
+	rawtestchunk_t *chunk;
+	int i, chunkpos, last;
+
+	for (i = 0; i < numobjects; i++)
+	{
+		chunk = &chunks[i];
+		last = ((i + 1) < numobjects) ? chunks[i+1].offset : filelen;
+		chunkpos = ReadRLCompressedStreamTest(NULL, buffer, chunk->offset, filelen, chunk->size, decompress255, halfres, false);
+		if (chunkpos == last)
+			continue;
+		chunkpos = ReadRLCompressedStreamTest(NULL, buffer, chunk->offset, filelen, (chunk->width + 256) * chunk->height, decompress255, halfres, false);
+		if (chunkpos == last)
+		{
+			chunk->width = chunk->width + 256;
+			chunk->size = chunk->width*chunk->height;
+			continue;
+		}
+		chunkpos = ReadRLCompressedStreamTest(NULL, buffer, chunk->offset, filelen, chunk->width * (chunk->height + 256), decompress255, halfres, false);
+		if (chunkpos == last)
+		{
+			chunk->height = chunk->height + 256;
+			chunk->size = chunk->width*chunk->height;
+			continue;
+		}
+		chunkpos = ReadRLCompressedStreamTest(NULL, buffer, chunk->offset, filelen, (chunk->width + 256) * (chunk->height + 256), decompress255, halfres, false);
+		if (chunkpos == last)
+		{
+			chunk->width = chunk->width + 256;
+			chunk->height = chunk->height + 256;
+			chunk->size = chunk->width*chunk->height;
+			continue;
+		}
+		break;
+	}
+	return i;
+}
+
+// read object headers of type 3-5, returns false if offsets are not going up
+static bool RawTestReadHeaders(byte *buffer, int headerspos, rawtestchunk_t *chunks, int numobjects, int resmult)
+{
+	int i, last;
+	byte *chunk;
+
+	last = -1;
+	for (i = 0; i < numobjects; i++)
+	{
+		chunk = buffer + headerspos + i*8;
+		chunks[i].offset = headerspos + numobjects*8 + ReadUInt(chunk);
+		chunks[i].width = chunk[4] * resmult;
+		chunks[i].height = chunk[5] * resmult;
+		chunks[i].size = chunks[i].width*chunks[i].height;
+		if (chunks[i].offset <= last)
+			return false;
+		last = chunks[i].offset;
+	}
+	return true;
+}
+
+// read pixel streams of all objects, returns end pos
+static int RawTestReadStreams(byte *buffer, int filelen, rawtestchunk_t *chunks, int numobjects, bool decompress255, bool halfres)
+{
+	int i, chunkpos;
+
+	chunkpos = 0;
+	for (i = 0; i < numobjects; i++)
+	{
+		chunkpos = ReadRLCompressedStreamTest(NULL, buffer, chunks[i].offset, filelen, chunks[i].size, decompress255, halfres, false);
+		if (chunkpos < 0)
+			return chunkpos;
+	}
+	return chunkpos;
+}
+
+int RawExtractTest_Type1(byte *buffer, int filelen, rawinfo_t *rawinfo)
+{
+	if (filelen < 1 || buffer[0] != 1)
+		return RAWX_ERROR_HEADER_NOT_VALID;
+	if (filelen < 788)
+		return RAWX_ERROR_FILE_SMALLER_THAN_REQUIRED; // shorter than header
+	if (buffer[784] > 120 || buffer[785] > 120)
+		return RAWX_ERROR_WIDTH_OR_HEIGHT_NOT_VALID;
+	if (filelen - (788 + buffer[784]*buffer[785]) > 32)
+		return RAWX_ERROR_FILE_BIGGER_THAN_REQUIRED;
+	if (filelen < (781 + buffer[784]*buffer[785]))
+		return RAWX_ERROR_FILE_SMALLER_THAN_REQUIRED;
+	rawinfo->width = buffer[784];
+	rawinfo->height = buffer[785];
+	return 0;
+}
+
+int RawExtractTest_Type2(byte *buffer, int filelen, rawinfo_t *rawinfo)
+{
+	int numobjects, i, pos1, pos2, chunkpos, resmult;
+	byte *chunk;
+
+	if (filelen < 4 || buffer[2] != 0 || buffer[3] != 0)
+		return RAWX_ERROR_HEADER_NOT_VALID;
+	numobjects = buffer[1] * 256 + buffer[0];
+	if (numobjects <= 0 || numobjects > 200)
+		return RAWX_ERROR_IMPLICIT_OBJECTS_COUNT;
+	if (filelen < (776 + (768 + 8)*numobjects))
+		return RAWX_ERROR_FILE_SMALLER_THAN_REQUIRED;
+
+	// see RawExtract_Type2 for doubleres detection
+	pos2 = pos1 = 776 + (768 + 8)*numobjects;
+	for (i = 0; i < numobjects; i++)
+	{
+		chunk = buffer + 776 + (768 + 8)*i + 768;
+		pos1 += chunk[4]*chunk[5];
+		pos2 += chunk[4]*chunk[5]*4;
+	}
+	if (rawinfo->doubleres == rauto)
+	{
+		if ((filelen - pos1) < 32)
+		{
+			resmult = 1;
+			chunkpos = pos1;
+		}
+		else if ((filelen - pos2) < 32)
+		{
+			resmult = 2;
+			chunkpos = pos2;
+		}
+		else
+			return RAWX_ERROR_FILE_BIGGER_THAN_REQUIRED;
+	}
+	else
+	{
+		resmult = (rawinfo->doubleres == rtrue) ? 2 : 1;
+		chunkpos = (resmult == 2) ? pos2 : pos1;
+	}
+	if (filelen < chunkpos)
+		return RAWX_ERROR_FILE_SMALLER_THAN_REQUIRED;
+	rawinfo->doubleres = (resmult == 2) ? rtrue : rfalse;
+	return chunkpos;
+}
+
+int RawExtractTest_Type3(byte *buffer, int filelen, rawinfo_t *rawinfo)
+{
+	rawtestchunk_t chunks[1000];
+	bool decompress255, halfres;
+	int numobjects;
+
+	if (filelen < 780)
+		return RAWX_ERROR_FILE_SMALLER_THAN_REQUIRED;
+	numobjects = ReadUInt(buffer);
+	if (numobjects <= 0 || numobjects > 1000)
+		return RAWX_ERROR_IMPLICIT_OBJECTS_COUNT;
+	if (filelen < (780 + 8*numobjects))
+		return RAWX_ERROR_FILE_SMALLER_THAN_REQUIRED;
+	if (filelen < 784)
+		return RAWX_ERROR_BAD_COLORMAP;
+	if (filelen < (780 + 8*numobjects + 2))
+		return RAWX_ERROR_FILE_SMALLER_THAN_REQUIRED;
+	if (!RawTestReadHeaders(buffer, 780, chunks, numobjects, 1))
+		return RAWX_ERROR_BAD_OBJECT_OFFSET;
+
+	// detection order is same as in RawExtract_Type3, chunks size changes are carried on
+	halfres = true;
+	decompress255 = true;
+	if (RawTestDetect(buffer, filelen, chunks, numobjects, decompress255, halfres) < numobjects)
+	{
+		decompress255 = false;
+		if (RawTestDetect(buffer, filelen, chunks, numobjects, decompress255, halfres) < numobjects)
+		{
+			halfres = false;
+			decompress255 = true;
+			if (RawTestDetect(buffer, filelen, chunks, numobjects, decompress255, halfres) < numobjects)
+				decompress255 = false;
+		}
+	}
+	return RawTestReadStreams(buffer, filelen, chunks, numobjects, decompress255, halfres);
+}
+
+int RawExtractTest_Type4(byte *buffer, int filelen, rawinfo_t *rawinfo)
+{
+	rawtestchunk_t chunks[1000];
+	int numobjects, objbitssize;
+	bool halfres;
+
+	if (filelen < 782)
+		return RAWX_ERROR_FILE_SMALLER_THAN_REQUIRED;
+	numobjects = ReadUInt(buffer);
+	if (numobjects <= 0 || numobjects > 1000)
+		return RAWX_ERROR_IMPLICIT_OBJECTS_COUNT;
+	if (filelen < (780 + 9*numobjects))
+		return RAWX_ERROR_FILE_SMALLER_THAN_REQUIRED;
+	objbitssize = RoundStruct(numobjects);
+	if (filelen < (784 + 2*objbitssize))
+		return RAWX_ERROR_BAD_COLORMAP;
+	if (filelen < (780 + objbitssize + 8*numobjects + 2))
+		return RAWX_ERROR_FILE_SMALLER_THAN_REQUIRED;
+	// try with not-rounded objbitssize
+	if (!RawTestReadHeaders(buffer, 780 + objbitssize, chunks, numobjects, 1))
+		if (!RawTestReadHeaders(buffer, 780 + numobjects, chunks, numobjects, 1))
+			return RAWX_ERROR_BAD_OBJECT_OFFSET;
+
+	// detect half-width compression
+	halfres = true;
+	if (RawTestDetect(buffer, filelen, chunks, numobjects, true, halfres) < numobjects)
+		halfres = false;
+	return RawTestReadStreams(buffer, filelen, chunks, numobjects, true, halfres);
+}
+
+int RawExtractTest_Type5(byte *buffer, int filelen, rawinfo_t *rawinfo)
+{
+	rawtestchunk_t chunks[1000];
+	bool decompress255;
+	int numobjects;
+
+	if (filelen < 776)
+		return RAWX_ERROR_FILE_SMALLER_THAN_REQUIRED;
+	numobjects = ReadUInt(buffer);
+	if (numobjects <= 0 || numobjects > 1000)
+		return RAWX_ERROR_IMPLICIT_OBJECTS_COUNT;
+	if (filelen < (776 + 8*numobjects))
+		return RAWX_ERROR_FILE_SMALLER_THAN_REQUIRED;
+	if (filelen < 784)
+		return RAWX_ERROR_BAD_COLORMAP;
+	if (filelen < (776 + 8*numobjects + 2))
+		return RAWX_ERROR_FILE_SMALLER_THAN_REQUIRED;
+
+	// RawExtract_Type5 detects 255 compression before object headers are read, on empty
+	// chunks this only passes for single object file which decompresses from file start
+	decompress255 = (numobjects == 1 && ReadRLCompressedStreamTest(NULL, buffer, 0, filelen, 256*256, true, false, false) == filelen);
+	if (!RawTestReadHeaders(buffer, 776, chunks, numobjects, (rawinfo->doubleres == rtrue) ? 2 : 1))
+		return RAWX_ERROR_BAD_OBJECT_OFFSET;
+	return RawTestReadStreams(buffer, filelen, chunks, numobjects, decompress255, false);
+}
+
 /*
 ==========================================================================================
 
@@ -2213,17 +2468,103 @@ rawblock_t *RawExtract_Type5(byte *buffer, int filelen, rawinfo_t *rawinfo, bool
 ==========================================================================================
 */
 
+// autoscan statistics
+volatile int rawtrials = 0;
+volatile int rawtrialsskipped = 0;
+
+void RawExtractStats(int *trials, int *skipped, bool reset)
+{
+	if (trials)
+		*trials = rawtrials;
+	if (skipped)
+		*skipped = rawtrialsskipped;
+	if (reset)
+	{
+		rawtrials = 0;
+		rawtrialsskipped = 0;
+	}
+}
+
+// check that object offsets in headers are going up, as types 3-5 require
+static bool RawObjectOffsetsValid(byte *buffer, int headerspos, int numobjects)
+{
+	int i, offset, last;
+
+	last = -1;
+	for (i = 0; i < numobjects; i++)
+	{
+		offset = headerspos + numobjects*8 + ReadUInt(buffer + headerspos + i*8);
+		if (offset <= last)
+			return false;
+		last = offset;
+	}
+	return true;
+}
+
+// cheap test of header and size constraints of raw types 1-5
+// returns bitmask of (1 << rawtype) for types which could be extracted, type is only dropped
+// if it's extractor would certainly fail, so autoscan results are the same
+int RawSignatureMask(byte *buffer, int filelen)
+{
+	int mask, numobjects, objbitssize, w, h;
+
+	mask = 0;
+	if (filelen <= 0)
+		return 0;
+
+	// type 1: tag 1, small single object
+	if (buffer[0] == 1)
+	{
+		if (filelen < 788)
+			mask |= (1 << RAW_TYPE_1); // extractor decides
+		else
+		{
+			w = buffer[784];
+			h = buffer[785];
+			if (w <= 120 && h <= 120 && (filelen - (788 + w*h)) <= 32 && filelen >= (781 + w*h))
+				mask |= (1 << RAW_TYPE_1);
+		}
+	}
+
+	// type 2: 16-bit objects count and per-object colormaps
+	if (filelen >= 776 && buffer[2] == 0 && buffer[3] == 0)
+	{
+		numobjects = buffer[1] * 256 + buffer[0];
+		if (numobjects > 0 && numobjects <= 200 && filelen >= (776 + 776*numobjects))
+			mask |= (1 << RAW_TYPE_2);
+	}
+
+	// types 3-5: 32-bit objects count and shared colormap
+	if (filelen < 784)
+		return mask;
+	numobjects = (int)ReadUInt(buffer);
+	if (numobjects <= 0 || numobjects > 1000)
+		return mask;
+	if (filelen >= (782 + 8*numobjects) && RawObjectOffsetsValid(buffer, 780, numobjects))
+		mask |= (1 << RAW_TYPE_3);
+	if (filelen >= (778 + 8*numobjects) && RawObjectOffsetsValid(buffer, 776, numobjects))
+		mask |= (1 << RAW_TYPE_5);
+	objbitssize = RoundStruct(numobjects);
+	if (filelen >= (780 + 9*numobjects) && filelen >= (784 + 2*objbitssize) && filelen >= (782 + objbitssize + 8*numobjects))
+		if (RawObjectOffsetsValid(buffer, 780 + objbitssize, numobjects) || RawObjectOffsetsValid(buffer, 780 + numobjects, numobjects))
+			mask |= (1 << RAW_TYPE_4);
+	return mask;
+}
+
 rawblock_t *RawExtract(byte *filedata, int filelen, rawinfo_t *rawinfo, bool testonly, bool verbose, rawtype_t forcetype)
 {
 	rawtype_t rawtype, testtype;
 	rawblock_t *rawblock;
+	int mask;
 
 	rawtype = (forcetype == RAW_TYPE_UNKNOWN) ? rawinfo->type : forcetype;
 	rawblock = NULL;
 
 	// pass or autoscan default types
+	// when autoscanning, types which could not fit are not tried at all
 	if (rawtype == RAW_TYPE_0) { rawblock = RawExtract_Type0(filedata, filelen, rawinfo, testonly, verbose, false); goto end; }
-	#define trytype(t,f)	if (rawtype == RAW_TYPE_UNKNOWN || rawtype == t) { testtype = t; rawblock = f(filedata, filelen, rawinfo, testonly, verbose, false); if (rawblock->errorcode >= 0 || rawtype != RAW_TYPE_UNKNOWN) goto end; FreeRawBlock(rawblock); rawblock = NULL; }
+	mask = (rawtype == RAW_TYPE_UNKNOWN) ? RawSignatureMask(filedata, filelen) : -1;
+	#define trytype(t,f)	if (rawtype == RAW_TYPE_UNKNOWN || rawtype == t) { if (!(mask & (1 << t))) Thread_AtomicIncrement(&rawtrialsskipped); else { Thread_AtomicIncrement(&rawtrials); testtype = t; rawblock = f(filedata, filelen, rawinfo, testonly, verbose, false); if (rawblock->errorcode >= 0 || rawtype != RAW_TYPE_UNKNOWN) goto end; FreeRawBlock(rawblock); rawblock = NULL; } }
 	trytype(RAW_TYPE_1, RawExtract_Type1)
 	trytype(RAW_TYPE_2, RawExtract_Type2)
 	trytype(RAW_TYPE_4, RawExtract_Type4) 	// VorteX: scan type4 and type5 before type3, because they are derivations from type3
@@ -2239,43 +2580,88 @@ end:
 	return rawblock;
 }
 
+// test-only RawExtract, returns file end pos or error code and sets rawinfo->type
+int RawExtractTest(byte *filedata, int filelen, rawinfo_t *rawinfo, rawtype_t forcetype)
+{
+	rawtype_t rawtype, testtype;
+	rawblock_t *rawblock;
+	int mask, result;
+
+	rawtype = (forcetype == RAW_TYPE_UNKNOWN) ? rawinfo->type : forcetype;
+
+	// type 0 is set externally and never autoscanned
+	if (rawtype == RAW_TYPE_0)
+	{
+		rawblock = RawExtract(filedata, filelen, rawinfo, true, false, forcetype);
+		result = rawblock->errorcode;
+		FreeRawBlock(rawblock);
+		return result;
+	}
+	result = RAWX_ERROR_NOT_INDENTIFIED;
+	mask = (rawtype == RAW_TYPE_UNKNOWN) ? RawSignatureMask(filedata, filelen) : -1;
+	#define trytype(t,f)	if (rawtype == RAW_TYPE_UNKNOWN || rawtype == t) { if (!(mask & (1 << t))) Thread_AtomicIncrement(&rawtrialsskipped); else { Thread_AtomicIncrement(&rawtrials); testtype = t; result = f(filedata, filelen, rawinfo); if (result >= 0 || rawtype != RAW_TYPE_UNKNOWN) goto end; result = RAWX_ERROR_NOT_INDENTIFIED; } }
+	trytype(RAW_TYPE_1, RawExtractTest_Type1)
+	trytype(RAW_TYPE_2, RawExtractTest_Type2)
+	trytype(RAW_TYPE_4, RawExtractTest_Type4)
+	trytype(RAW_TYPE_5, RawExtractTest_Type5)
+	trytype(RAW_TYPE_3, RawExtractTest_Type3)
+	#undef trytype
+	// not identified, rawinfo type is left as is
+	return result;
+end:
+	rawinfo->type = testtype;
+	return result;
+}
+
 // nasty nasty hack to handle multifile files like vortout.htm
 void RawExtractTGATailFiles(byte *filedata, int filelen, rawinfo_t *rawinfo, char *outfile, bool verbose, bool usesubpaths, bool rawnoalign)
 {
 	rawblock_t *rawblock;
 	char outfile2[MAX_OSPATH], suffix[16];
-	int i, numtries, maxtries;
+	int i, endpos;
+	rawinfo_t testinfo;
 	rawtype_t oldtype;
 	byte *in;
 
 	in = filedata;
 
-	maxtries = 16;
 	// force rawinfo type to unknown as tail file could be random type
 	oldtype = rawinfo->type;
 	rawinfo->type = RAW_TYPE_UNKNOWN;
 	// try extract tail files
 	for (i = 1; filelen > 16; i++)
 	{
+		// single forward scan for tail start, full test is only done where signature fits
+		endpos = 0;
+		for (; filelen > 16; in++, filelen--)
+		{
+			if (!RawSignatureMask(in, filelen))
+				continue;
+			memcpy(&testinfo, rawinfo, sizeof(rawinfo_t));
+			endpos = RawExtractTest(in, filelen, &testinfo, RAW_TYPE_UNKNOWN);
+			if (endpos > 0)
+				break;
+		}
+		if (endpos <= 0)
+		{
+			Warning("no tail file found after offset %i", in - filedata);
+			break;
+		}
 		sprintf(suffix, "_sub%0i", i);
 		AddSuffix(outfile2, outfile, suffix);
 		if (verbose)
 			Print("Found tail file at offset %i (%i bytes size), extracting...\n", in - filedata, filelen);
-		for(numtries = 0; filelen > 0 && numtries < maxtries; numtries++)
+		// extract, failed one could not be skipped by it's size so scan goes on from next byte
+		rawblock = RawExtract(in, filelen, rawinfo, false, verbose, testinfo.type);
+		if (rawblock->errorcode <= 0)
 		{
-			rawblock = RawExtract(in, filelen, rawinfo, false, verbose, RAW_TYPE_UNKNOWN);
-			if (rawblock->errorcode > 0)
-				break;
+			Warning("tail file at offset %i failed to extract: %s", in - filedata, RawStringForResult(rawblock->errorcode));
+			FreeRawBlock(rawblock);
 			in++;
 			filelen--;
-			FreeRawBlock(rawblock);
-		}
-		if (numtries >= maxtries) // failed
-		{
-			Error("Failed to read tail file\n");
-			break;
+			i--;
+			continue;
 		}
-		// extract
 		TGAfromRAW(rawblock, rawinfo, outfile2, rawnoalign, verbose, usesubpaths);
 		in += rawblock->errorcode;
 		filelen -= rawblock->errorcode;
@@ -148,7 +148,10 @@ void FreeRawBlock(rawblock_t *block);
 void RawTGA(char *outfile, int width, int height, int bx, int by, int ax, int ay, const byte *colormapdata, const byte *pixeldata, int bpp, rawinfo_t *rawinfo);
 void RawTGAColormap(char *outfile, const byte *colormapdata, byte bytes, int width, int height);
 void ColormapFromTGA(char *filename, byte *colormap);
+int RawSignatureMask(byte *buffer, int filelen);
 rawblock_t *RawExtract(byte *filedata, int filelen, rawinfo_t *rawinfo, bool testonly, bool verbose, rawtype_t forcetype);
+void RawExtractStats(int *trials, int *skipped, bool reset);
+int RawExtractTest(byte *filedata, int filelen, rawinfo_t *rawinfo, rawtype_t forcetype);
 void RawExtractTGATailFiles(byte *filedata, int filelen, rawinfo_t *rawinfo, char *outfile, bool verbose, bool usesubpaths, bool rawnoalign);
 
 #endif
\ No newline at end of file
@@ -12,6 +12,16 @@ bool SoX_DataToFile(byte *data, int databytes, char *generalcmd, char *inputcmd,
 
 bool SoX_FileToData(char *in, char *generalcmd, char *inputcmd, char *outputcmd, int *outdatabytesptr, byte **outdataptr, char *effects);
 
+// builtin codecs for plain raw ADPCM <-> 16-bit PCM WAV and raw ADPCM/PCM -> Ogg Vorbis conversions
+#define SOX_NATIVE_NONE		0
+#define SOX_NATIVE_DECODE	1
+#define SOX_NATIVE_ENCODE	2
+#define SOX_NATIVE_VORBIS	3
+
+bool SoX_Native(char *generalcmd, char *inputcmd, char *outputcmd, char *effects);
+
+bool SoX_NativeDataToData(byte *data, int databytes, char *generalcmd, char *inputcmd, char *outputcmd, byte **outdataptr, int *outdatabytesptr, char *effects);
+
 // SoX errors
 #define SOXSUPP_ERROR_SOXNOTFOUND		-1
 #define SOXSUPP_ERROR_PROCESSFAIL		-2
@@ -0,0 +1,330 @@
+////////////////////////////////////////////////////////////////
+//
+// Blood Pill - threads and worker pool
+//
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+////////////////////////////////
+
+#include "bloodpill.h"
+#include "thread.h"
+
+#ifdef WIN32
+# include <windows.h>
+#else
+# include <pthread.h>
+# include <unistd.h>
+#endif
+
+int numthreads = 1;
+
+int Thread_NumCPUs(void)
+{
+#ifdef WIN32
+	SYSTEM_INFO info;
+
+	GetSystemInfo(&info);
+	return max(1, (int)info.dwNumberOfProcessors);
+#else
+	long n;
+
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+	return (n > 0) ? (int)n : 1;
+#endif
+}
+
+bool Thread_ParseOption(int argc, char **argv, int *i)
+{
+	if (strcmp(argv[*i], "-threads"))
+		return false;
+	(*i)++;
+	if (*i < argc)
+	{
+		numthreads = atoi(argv[*i]);
+		if (numthreads <= 0)
+			numthreads = Thread_NumCPUs();
+		Verbose("Option: %i threads\n", numthreads);
+	}
+	return true;
+}
+
+/*
+==========================================================================================
+
+  MUTEXES
+
+==========================================================================================
+*/
+
+void *Thread_CreateMutex(void)
+{
+#ifdef WIN32
+	return (void *)CreateMutex(NULL, FALSE, NULL);
+#else
+	pthread_mutex_t *mutex;
+
+	mutex = (pthread_mutex_t *)mem_alloc(sizeof(pthread_mutex_t));
+	pthread_mutex_init(mutex, NULL);
+	return mutex;
+#endif
+}
+
+void Thread_DestroyMutex(void *mutex)
+{
+	if (!mutex)
+		return;
+#ifdef WIN32
+	CloseHandle((HANDLE)mutex);
+#else
+	pthread_mutex_destroy((pthread_mutex_t *)mutex);
+	mem_free(mutex);
+#endif
+}
+
+void Thread_LockMutex(void *mutex)
+{
+#ifdef WIN32
+	WaitForSingleObject((HANDLE)mutex, INFINITE);
+#else
+	pthread_mutex_lock((pthread_mutex_t *)mutex);
+#endif
+}
+
+void Thread_UnlockMutex(void *mutex)
+{
+#ifdef WIN32
+	ReleaseMutex((HANDLE)mutex);
+#else
+	pthread_mutex_unlock((pthread_mutex_t *)mutex);
+#endif
+}
+
+int Thread_AtomicIncrement(volatile int *value)
+{
+#ifdef WIN32
+	return (int)InterlockedIncrement((volatile LONG *)value);
+#else
+	return __sync_add_and_fetch(value, 1);
+#endif
+}
+
+/*
+==========================================================================================
+
+  SEMAPHORES
+
+==========================================================================================
+*/
+
+#ifndef WIN32
+typedef struct
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t  cond;
+	int             count;
+}semaphore_t;
+#endif
+
+void *Thread_CreateSemaphore(int count)
+{
+#ifdef WIN32
+	return (void *)CreateSemaphore(NULL, count, max(count, 1), NULL);
+#else
+	semaphore_t *semaphore;
+
+	semaphore = (semaphore_t *)mem_alloc(sizeof(semaphore_t));
+	pthread_mutex_init(&semaphore->mutex, NULL);
+	pthread_cond_init(&semaphore->cond, NULL);
+	semaphore->count = count;
+	return semaphore;
+#endif
+}
+
+void Thread_DestroySemaphore(void *semaphore)
+{
+	if (!semaphore)
+		return;
+#ifdef WIN32
+	CloseHandle((HANDLE)semaphore);
+#else
+	pthread_cond_destroy(&((semaphore_t *)semaphore)->cond);
+	pthread_mutex_destroy(&((semaphore_t *)semaphore)->mutex);
+	mem_free(semaphore);
+#endif
+}
+
+void Thread_WaitSemaphore(void *semaphore)
+{
+#ifdef WIN32
+	WaitForSingleObject((HANDLE)semaphore, INFINITE);
+#else
+	semaphore_t *s = (semaphore_t *)semaphore;
+
+	pthread_mutex_lock(&s->mutex);
+	while(s->count <= 0)
+		pthread_cond_wait(&s->cond, &s->mutex);
+	s->count--;
+	pthread_mutex_unlock(&s->mutex);
+#endif
+}
+
+void Thread_PostSemaphore(void *semaphore)
+{
+#ifdef WIN32
+	ReleaseSemaphore((HANDLE)semaphore, 1, NULL);
+#else
+	semaphore_t *s = (semaphore_t *)semaphore;
+
+	pthread_mutex_lock(&s->mutex);
+	s->count++;
+	pthread_cond_signal(&s->cond);
+	pthread_mutex_unlock(&s->mutex);
+#endif
+}
+
+/*
+==========================================================================================
+
+  THREADS
+
+==========================================================================================
+*/
+
+typedef struct
+{
+	int (*fn)(void *);
+	void *data;
+#ifndef WIN32
+	pthread_t thread;
+	int result;
+#endif
+}threadstart_t;
+
+#ifdef WIN32
+static DWORD WINAPI Thread_Start(void *parm)
+{
+	threadstart_t start;
+
+	start = *(threadstart_t *)parm;
+	mem_free(parm);
+	return (DWORD)start.fn(start.data);
+}
+#else
+static void *Thread_Start(void *parm)
+{
+	threadstart_t *start;
+
+	start = (threadstart_t *)parm;
+	start->result = start->fn(start->data);
+	return NULL;
+}
+#endif
+
+void *Thread_CreateThread(int (*fn)(void *), void *data)
+{
+	threadstart_t *start;
+#ifdef WIN32
+	HANDLE thread;
+#endif
+
+	start = (threadstart_t *)mem_alloc(sizeof(threadstart_t));
+	start->fn = fn;
+	start->data = data;
+#ifdef WIN32
+	thread = CreateThread(NULL, 0, Thread_Start, start, 0, NULL);
+	if (thread == NULL)
+		Error("Thread_CreateThread: failed to create thread (error %i)\n", (int)GetLastError());
+	return (void *)thread;
+#else
+	if (pthread_create(&start->thread, NULL, Thread_Start, start))
+		Error("Thread_CreateThread: failed to create thread\n");
+	return start;
+#endif
+}
+
+// waits for thread to finish and returns it's result
+int Thread_WaitThread(void *thread)
+{
+#ifdef WIN32
+	DWORD result;
+
+	WaitForSingleObject((HANDLE)thread, INFINITE);
+	GetExitCodeThread((HANDLE)thread, &result);
+	CloseHandle((HANDLE)thread);
+	return (int)result;
+#else
+	threadstart_t *start;
+	int result;
+
+	start = (threadstart_t *)thread;
+	pthread_join(start->thread, NULL);
+	result = start->result;
+	mem_free(start);
+	return result;
+#endif
+}
+
+/*
+==========================================================================================
+
+  WORKER POOL
+
+==========================================================================================
+*/
+
+typedef struct
+{
+	threadjob_t   func;
+	void         *data;
+	int           numjobs;
+	volatile int  nextjob;
+}threadjobs_t;
+
+static int Thread_Worker(void *parm)
+{
+	threadjobs_t *jobs;
+	int jobnum;
+
+	jobs = (threadjobs_t *)parm;
+	while(1)
+	{
+		jobnum = Thread_AtomicIncrement(&jobs->nextjob) - 1;
+		if (jobnum >= jobs->numjobs)
+			break;
+		jobs->func(jobnum, jobs->data);
+	}
+	return 0;
+}
+
+void Thread_RunJobs(int numjobs, threadjob_t func, void *data)
+{
+	void *threads[MAX_THREADS];
+	threadjobs_t jobs;
+	int i, n;
+
+	jobs.func = func;
+	jobs.data = data;
+	jobs.numjobs = numjobs;
+	jobs.nextjob = 0;
+
+	// calling thread is a worker too
+	n = min(min(numthreads, MAX_THREADS), numjobs) - 1;
+	for (i = 0; i < n; i++)
+		threads[i] = Thread_CreateThread(Thread_Worker, &jobs);
+	Thread_Worker(&jobs);
+	for (i = 0; i < n; i++)
+		Thread_WaitThread(threads[i]);
+}
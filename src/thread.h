@@ -0,0 +1,61 @@
+////////////////////////////////////////////////////////////////
+//
+// Blood Pill - threads and worker pool
+//
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+////////////////////////////////
+
+#ifndef __THREAD__
+#define __THREAD__
+
+#define MAX_THREADS 64
+
+// number of worker threads for parallel jobs, 1 - no threading
+extern int numthreads;
+
+int Thread_NumCPUs(void);
+
+// parses "-threads x" option at argv[*i] into numthreads (0 or less is number of CPUs)
+// returns false if it is other option, otherwise *i is moved to option value
+bool Thread_ParseOption(int argc, char **argv, int *i);
+
+// mutexes
+void *Thread_CreateMutex(void);
+void Thread_DestroyMutex(void *mutex);
+void Thread_LockMutex(void *mutex);
+void Thread_UnlockMutex(void *mutex);
+
+// semaphores, Wait blocks while count is zero, Post increments it
+void *Thread_CreateSemaphore(int count);
+void Thread_DestroySemaphore(void *semaphore);
+void Thread_WaitSemaphore(void *semaphore);
+void Thread_PostSemaphore(void *semaphore);
+
+// threads
+void *Thread_CreateThread(int (*fn)(void *), void *data);
+int Thread_WaitThread(void *thread);
+
+// returns incremented value
+int Thread_AtomicIncrement(volatile int *value);
+
+// worker pool
+// func is called once for every job number from 0 to numjobs-1, jobs are picked by workers
+// in order as they get free, so long jobs do not stall others; returns when all jobs are done
+typedef void (*threadjob_t)(int jobnum, void *data);
+void Thread_RunJobs(int numjobs, threadjob_t func, void *data);
+
+#endif
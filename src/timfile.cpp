@@ -121,14 +121,18 @@ tim_image_t *TIM_LoadFromBuffer(byte *buf, int buflen)
 	if (buflen < 4)
 		return TimError(tim, "unexpected EOF at CLUT/image");
 	nextobjlen = ReadUInt(buf);
+	if (nextobjlen <= 4)
+		return TimError(tim, "unable to read CLUT/image");
 	buf += 4;
 	buflen -= 4;
 
 	// load CLUT if presented
 	if (tim->type == TIM_4Bit || tim->type == TIM_8Bit)
 	{
+		if (buflen < nextobjlen)
+			return TimError(tim, "unexpected EOF at CLUT");
 		tim->CLUT = (tim_clutinfo_t *)mem_alloc(sizeof(tim_clutinfo_t));
-		memcpy(tim->CLUT, buf, nextobjlen-4);
+		memcpy(tim->CLUT, buf, min(nextobjlen-4, (long)sizeof(tim_clutinfo_t)));
 		buf += nextobjlen-4;
 		buflen -= nextobjlen-4;
 		nextobjlen = ReadUInt(buf);
@@ -291,26 +295,28 @@ tim_image_t *TIM_LoadFromStream(FILE *f)
 	return tim;
 }
 
-void TIM_WriteToStream(tim_image_t *tim, FILE *f)
+// write TIM file contents to buffer, which should hold tim->filelen bytes
+void TIM_WriteToBuffer(tim_image_t *tim, byte *buf)
 {
 	tim_diminfo_t diminfo;
 	unsigned int temp;
-	unsigned char *data;
+	byte *out;
 	int i;
 
 	// write header
+	out = buf;
 	temp = TIM_TAG;
-	fwrite(&temp, 4, 1, f);
-	fwrite(&tim->type, 4, 1, f);
+	memcpy(out, &temp, 4); out += 4;
+	memcpy(out, &tim->type, 4); out += 4;
 
 	// CLUT & size of pixelbytes
 	if (tim->type == TIM_4Bit || tim->type == TIM_8Bit)
 	{
 		temp = (unsigned int)(sizeof(tim_clutinfo_t) + 4);
-		fwrite(&temp, 4, 1, f);
-		fwrite(tim->CLUT, sizeof(tim_clutinfo_t), 1, f);
+		memcpy(out, &temp, 4); out += 4;
+		memcpy(out, tim->CLUT, sizeof(tim_clutinfo_t)); out += sizeof(tim_clutinfo_t);
 	}
-	fwrite(&tim->pixelbytes, 4, 1, f);
+	memcpy(out, &tim->pixelbytes, 4); out += 4;
 
 	// write dimensions
 	memcpy(&diminfo, &tim->dim, sizeof(tim_diminfo_t));
@@ -320,22 +326,20 @@ void TIM_WriteToStream(tim_image_t *tim, FILE *f)
 		diminfo.xsize = (short)(diminfo.xsize / 2);
 	else if (tim->type == TIM_24Bit)
 		diminfo.xsize = (short)(diminfo.xsize * 1.5);
-
-	fwrite(&diminfo, sizeof(tim_diminfo_t), 1, f);
+	memcpy(out, &diminfo, sizeof(tim_diminfo_t)); out += sizeof(tim_diminfo_t);
 
 	// write pixels
 	if (tim->type == TIM_16Bit)
 	{
 		// interleave pixelmask into tim
-		data = (byte *)mem_alloc(tim->pixelbytes);
 		if (tim->pixelmask != NULL)
 		{
 			for (i = 0; i < tim->pixelbytes; i += 2)
 			{
-				data[i] = tim->pixels[i];
-				data[i + 1] = (tim->pixels[i+1] & 0x7F);
+				out[i] = tim->pixels[i];
+				out[i + 1] = (tim->pixels[i+1] & 0x7F);
 				if (tim->pixelmask[i / 2])
-					data[i + 1] += 0x80;
+					out[i + 1] += 0x80;
 			}
 		}
 		// interleave with default white pixelmask
@@ -343,15 +347,23 @@ void TIM_WriteToStream(tim_image_t *tim, FILE *f)
 		{
 			for (i = 0; i < tim->pixelbytes; i += 2)
 			{
-				data[i] = tim->pixels[i];
-				data[i + 1] = (tim->pixels[i+1] & 0x7F) + 0x80;
+				out[i] = tim->pixels[i];
+				out[i + 1] = (tim->pixels[i+1] & 0x7F) + 0x80;
 			}
 		}
-		fwrite(data, tim->pixelbytes, 1, f);
-		mem_free(data);
 	}
 	else
-		fwrite(tim->pixels, tim->pixelbytes, 1, f);
+		memcpy(out, tim->pixels, tim->pixelbytes);
+}
+
+void TIM_WriteToStream(tim_image_t *tim, FILE *f)
+{
+	byte *data;
+
+	data = (byte *)mem_alloc(tim->filelen);
+	TIM_WriteToBuffer(tim, data);
+	fwrite(data, tim->filelen, 1, f);
+	mem_free(data);
 }
 
 /*
@@ -65,6 +65,8 @@ void FreeTIM(tim_image_t *tim);
 tim_image_t *TIM_LoadFromBuffer(byte *buf, int buflen);
 tim_image_t *TIM_LoadFromStream(FILE *f);
 
+void TIM_WriteToBuffer(tim_image_t *tim, byte *buf);
+
 void TIM_WriteToStream(tim_image_t *tim, FILE *f);
 
 tim_image_t *TIM_LoadFromTargaStream(FILE *f, unsigned int type);
@@ -4,158 +4,169 @@
 #include "bloodpill.h"
 #include "bigfile.h"
 
-// todo: cleanup
-// magic matrix used for VAG depacking
-double f[5][2] = 
+// frames decoded at once when streaming
+#define VAG_STREAM_FRAMES 256
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define VAG_SSE2
+#endif
+
+// prediction filters, coefficients are in 1/64 units
+static const int vagfilter[5][2] = 
 { 
-	{ 0.0, 0.0 },
-	{  60.0 / 64.0,  0.0 },
-	{  115.0 / 64.0, -52.0 / 64.0 },
-	{  98.0 / 64.0, -55.0 / 64.0 },
-	{  122.0 / 64.0, -60.0 / 64.0 } 
+	{   0,   0 },
+	{  60,   0 },
+	{ 115, -52 },
+	{  98, -55 },
+	{ 122, -60 } 
 };
-double samples[28];
 
 // VAG depacking - test raw PCM file
+// only walks frame headers, so it keeps no state and is safe to call from several threads
+// returns position where stream ends or -1 if it is not a valid stream
 unsigned int VAG_UnpackTest(byte *data, unsigned int datasize, int offset) 
 {
-	int predict_nr, shift_factor, flags;
-    int i, d, s, size;
-    static double s_1 = 0.0;
-    static double s_2 = 0.0;
-	byte *in;
+	int predict_nr, flags;
+	byte *in, *end;
 
-	// determine amount if data that should be written
-	// fixme: OPTIMIZE
-	in = data + offset; // skip VAG header
-	datasize = datasize - offset;
-	if (datasize < 0)
+	if (offset < 0 || datasize < (unsigned int)offset)
 		return -1;
-	size = 0;
-	#define inc() if(datasize < 0) return -1;in++;datasize--;
-	while(datasize > 0)
+	in = data + offset; // skip VAG header
+	end = data + datasize;
+	while(in < end)
 	{
-		predict_nr = in[0]; inc()
-		shift_factor = predict_nr & 0xf;
-		predict_nr = (int)(predict_nr >> 4);
-		if (predict_nr < 0)
+		// every frame is 16 bytes: predictor/shift, flags and 14 bytes of nibbles
+		if (end - in < 2)
 			return -1;
+		predict_nr = (int)(in[0] >> 4);
 		if (predict_nr > 4)
 			return -1;
-		flags = in[0]; inc() // flags
+		flags = in[1];
+		in += 2;
 		if (flags == 7 /*|| flags == 5*/)
 			break; // end of file     
-		for (i = 0; i < 28; i += 2) 
-		{
-			d = in[0]; inc()
-			s = (d & 0xf) << 12;
-			if (s & 0x8000)
-				s |= 0xffff0000;
-			samples[i] = (double)(s >> shift_factor);
-			s = (d & 0xf0) << 8;
-			if (s & 0x8000)
-			s |= 0xffff0000;
-			samples[i+1] = (double)(s >> shift_factor);
-		}
-		for ( i = 0; i < 28; i++ ) 
-		{
-			samples[i] = samples[i] + s_1 * f[predict_nr][0] + s_2 * f[predict_nr][1];
-			s_2 = s_1;
-			s_1 = samples[i];
-			d = (int)(samples[i] + 0.5);
-			size += 2;
-		}
+		if (end - in < 14)
+			return -1;
+		in += 14;
 	}
-	#undef inc
 	return in - data;
 }
 
+// unpack nibbles of 16-byte frame to 16-bit samples shifted by frame shift factor
+// samples are placed to raw[4..31], first 4 are made of frame header and not used
+static void VAG_UnpackNibbles(byte *frame, int shift_factor, short *raw)
+{
+#ifdef VAG_SSE2
+	__m128i in, lo, hi, nibbles, zero, count, mask;
+
+	// every byte holds two samples, low nibble goes first
+	// nibble is put to top of 16-bit word so arithmetic shift gives sign-extended sample
+	in = _mm_loadu_si128((__m128i *)frame);
+	zero = _mm_setzero_si128();
+	count = _mm_cvtsi32_si128(shift_factor);
+	mask = _mm_set1_epi8(0x0F);
+	lo = _mm_and_si128(in, mask);
+	hi = _mm_and_si128(_mm_srli_epi16(in, 4), mask);
+	nibbles = _mm_unpacklo_epi8(lo, hi);
+	_mm_storeu_si128((__m128i *)raw, _mm_sra_epi16(_mm_slli_epi16(_mm_unpacklo_epi8(zero, nibbles), 4), count));
+	_mm_storeu_si128((__m128i *)(raw + 8), _mm_sra_epi16(_mm_slli_epi16(_mm_unpackhi_epi8(zero, nibbles), 4), count));
+	nibbles = _mm_unpackhi_epi8(lo, hi);
+	_mm_storeu_si128((__m128i *)(raw + 16), _mm_sra_epi16(_mm_slli_epi16(_mm_unpacklo_epi8(zero, nibbles), 4), count));
+	_mm_storeu_si128((__m128i *)(raw + 24), _mm_sra_epi16(_mm_slli_epi16(_mm_unpackhi_epi8(zero, nibbles), 4), count));
+#else
+	int i;
+
+	for (i = 2; i < 16; i++)
+	{
+		raw[i*2] = (short)((short)((frame[i] & 0x0F) << 12) >> shift_factor);
+		raw[i*2 + 1] = (short)((short)((frame[i] & 0xF0) << 8) >> shift_factor);
+	}
+#endif
+}
+
+// decode one 16-byte frame to 28 samples, s_1 and s_2 hold predictor state
+// returns false if frame marks end of stream
+static bool VAG_UnpackFrame(byte *in, int *s_1, int *s_2, short *out)
+{
+	int predict_nr, shift_factor, flags, s, i;
+	short raw[32];
+
+	predict_nr = in[0] >> 4;
+	shift_factor = in[0] & 0x0F;
+	flags = in[1];
+	if (flags == 7 || flags == 5)
+		return false; // end of file
+	if (predict_nr > 4)
+		predict_nr = 0;
+	VAG_UnpackNibbles(in, shift_factor, raw);
+	for (i = 4; i < 32; i++)
+	{
+		s = raw[i] + ((*s_1 * vagfilter[predict_nr][0] + *s_2 * vagfilter[predict_nr][1] + 32) >> 6);
+		if (s > 32767)
+			s = 32767;
+		else if (s < -32768)
+			s = -32768;
+		*s_2 = *s_1;
+		*s_1 = s;
+		out[i - 4] = (short)s;
+	}
+	return true;
+}
+
 // VAG depacking - writes raw PCM file
+// single pass with integer prediction, state is kept per call so it is safe to call from several threads
 void VAG_Unpack(byte *data, int offset, int databytes, byte **bufferptr, int *outsize) 
 {
-    int predict_nr, shift_factor, flags, datasize;
-    int i, d, s, size;
-    static double s_1 = 0.0;
-    static double s_2 = 0.0;
-	byte *in, *out;
+	int numframes, s_1, s_2, i;
+	short samples[28];
+	byte *in, *end, *out;
 
-	// determine amount if data that should be written
-	// fixme: OPTIMIZE
+	// output is sized by frame count, every 16-byte frame gives 28 samples
+	numframes = (databytes > offset) ? (databytes - offset) / 16 : 0;
+	*bufferptr = (byte *)mem_alloc(numframes * 28 * 2 + 1);
+	out = *bufferptr;
+	s_1 = 0;
+	s_2 = 0;
 	in = data + offset; // skip VAG header
-	datasize = databytes - offset;
-	size = 0;
-	#define inc() if(datasize < 0) break;in++;datasize--;
-	while(datasize > 0)
+	end = in + numframes * 16;
+	for (; in < end && VAG_UnpackFrame(in, &s_1, &s_2, samples); in += 16)
 	{
-		predict_nr = in[0]; inc()
-		shift_factor = predict_nr & 0xf;
-		predict_nr >>= 4;
-		flags = in[0]; inc() // flags
-		if (flags == 7 || flags == 5)
-			break;    
-		for (i = 0; i < 28; i += 2) 
+		for (i = 0; i < 28; i++)
 		{
-			d = in[0]; inc()
-			s = (d & 0xf) << 12;
-			if (s & 0x8000)
-				s |= 0xffff0000;
-			samples[i] = (double)(s >> shift_factor);
-			s = (d & 0xf0) << 8;
-			if (s & 0x8000)
-			s |= 0xffff0000;
-			samples[i+1] = (double)(s >> shift_factor);
-		}
-		for ( i = 0; i < 28; i++ ) 
-		{
-			samples[i] = samples[i] + s_1 * f[predict_nr][0] + s_2 * f[predict_nr][1];
-			s_2 = s_1;
-			s_1 = samples[i];
-			d = (int)(samples[i] + 0.5);
-			size += 2;
+			out[0] = samples[i] & 0xff;
+			out[1] = (samples[i] >> 8) & 0xff;
+			out += 2;
 		}
 	}
-      
-	// decode
-	in = data + offset;
-	datasize = databytes - offset;
-	*bufferptr = (byte *)mem_alloc(size);
-	out = *bufferptr;
-	while(1)
+	*outsize = out - *bufferptr;
+}
+
+// VAG depacking - passes samples to sink by blocks of VAG_STREAM_FRAMES frames
+void VAG_UnpackStream(byte *data, int offset, int databytes, pcmsink_t sink, void *sinkdata)
+{
+	int numframes, s_1, s_2, n;
+	short samples[VAG_STREAM_FRAMES * 28];
+	byte *in, *end;
+
+	numframes = (databytes > offset) ? (databytes - offset) / 16 : 0;
+	s_1 = 0;
+	s_2 = 0;
+	n = 0;
+	in = data + offset; // skip VAG header
+	end = in + numframes * 16;
+	for (; in < end && VAG_UnpackFrame(in, &s_1, &s_2, samples + n * 28); in += 16)
 	{
-		predict_nr = in[0]; inc()
-		shift_factor = predict_nr & 0xf;
-		predict_nr >>= 4;
-		flags = in[0]; inc() // flags
-		if (flags == 7 || flags == 5)
-			break;   
-		for (i = 0; i < 28; i += 2) 
-		{
-			d = in[0]; inc()
-			s = (d & 0xf) << 12;
-			if (s & 0x8000)
-				s |= 0xffff0000;
-			samples[i] = (double)(s >> shift_factor);
-			s = (d & 0xf0) << 8;
-			if (s & 0x8000)
-			s |= 0xffff0000;
-			samples[i+1] = (double)(s >> shift_factor);
-		}
-		for ( i = 0; i < 28; i++ ) 
+		if (++n == VAG_STREAM_FRAMES)
 		{
-			samples[i] = samples[i] + s_1 * f[predict_nr][0] + s_2 * f[predict_nr][1];
-			s_2 = s_1;
-			s_1 = samples[i];
-			d = (int)(samples[i] + 0.5);
-			out[0] = d & 0xff;
-			out[1] = d >> 8;
-			out += 2;
+			sink(samples, n * 28, sinkdata);
+			n = 0;
 		}
 	}
-	*outsize = size;
-	#undef inc
+	if (n)
+		sink(samples, n * 28, sinkdata);
 }
 
-
 /*
 void VAG_Unpack(FILE *vag, FILE *pcm)			
 {
@@ -1,3 +1,8 @@
+#include "wavfile.h"
+
 // VAG depacking - writes raw PCM file
 unsigned int VAG_UnpackTest(byte *data, unsigned int datasize, int offset);
-void VAG_Unpack(byte *data, int offset, int datasize, byte **bufferptr, int *outsize);
\ No newline at end of file
+void VAG_Unpack(byte *data, int offset, int datasize, byte **bufferptr, int *outsize);
+
+// VAG depacking - passes 16-bit samples to sink by blocks, so whole sound is never held in memory
+void VAG_UnpackStream(byte *data, int offset, int datasize, pcmsink_t sink, void *sinkdata);
\ No newline at end of file
@@ -0,0 +1,318 @@
+////////////////////////////////////////////////////////////////
+//
+// Blood Pill - Ogg Vorbis encoding
+//
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+////////////////////////////////
+
+
+#include "bloodpill.h"
+#include "vorbis.h"
+
+// Ogg and Vorbis structures (from ogg.h and codec.h)
+// only ogg_page fields are used, others are passed to library as is,
+// so they are declared as opaque blocks large enough to hold the real ones
+#ifdef _MSC_VER
+typedef __int64 ogg_int64_t;
+#else
+typedef long long ogg_int64_t;
+#endif
+
+typedef struct
+{
+	unsigned char *header;
+	long           header_len;
+	unsigned char *body;
+	long           body_len;
+}ogg_page;
+
+typedef struct { ogg_int64_t opaque[16];  } ogg_packet;       // 48 bytes in libogg 1.3
+typedef struct { ogg_int64_t opaque[64];  } ogg_stream_state; // 408 bytes
+typedef struct { ogg_int64_t opaque[16];  } vorbis_info;      // 56 bytes in libvorbis 1.3
+typedef struct { ogg_int64_t opaque[8];   } vorbis_comment;   // 32 bytes
+typedef struct { ogg_int64_t opaque[64];  } vorbis_dsp_state; // 144 bytes
+typedef struct { ogg_int64_t opaque[64];  } vorbis_block;     // 192 bytes
+
+// dll functions to import, q-prefixed so they never clash with ones from real headers
+static int   (*qogg_stream_init) (ogg_stream_state *os, int serialno);
+static int   (*qogg_stream_clear) (ogg_stream_state *os);
+static int   (*qogg_stream_packetin) (ogg_stream_state *os, ogg_packet *op);
+static int   (*qogg_stream_pageout) (ogg_stream_state *os, ogg_page *og);
+static int   (*qogg_stream_flush) (ogg_stream_state *os, ogg_page *og);
+static int   (*qogg_page_eos) (const ogg_page *og);
+
+static void  (*qvorbis_info_init) (vorbis_info *vi);
+static void  (*qvorbis_info_clear) (vorbis_info *vi);
+static void  (*qvorbis_comment_init) (vorbis_comment *vc);
+static void  (*qvorbis_comment_clear) (vorbis_comment *vc);
+static int   (*qvorbis_analysis_init) (vorbis_dsp_state *v, vorbis_info *vi);
+static int   (*qvorbis_block_init) (vorbis_dsp_state *v, vorbis_block *vb);
+static int   (*qvorbis_block_clear) (vorbis_block *vb);
+static void  (*qvorbis_dsp_clear) (vorbis_dsp_state *v);
+static int   (*qvorbis_analysis_headerout) (vorbis_dsp_state *v, vorbis_comment *vc, ogg_packet *op, ogg_packet *op_comm, ogg_packet *op_code);
+static float **(*qvorbis_analysis_buffer) (vorbis_dsp_state *v, int vals);
+static int   (*qvorbis_analysis_wrote) (vorbis_dsp_state *v, int vals);
+static int   (*qvorbis_analysis_blockout) (vorbis_dsp_state *v, vorbis_block *vb);
+static int   (*qvorbis_analysis) (vorbis_block *vb, ogg_packet *op);
+static int   (*qvorbis_bitrate_addblock) (vorbis_block *vb);
+static int   (*qvorbis_bitrate_flushpacket) (vorbis_dsp_state *vd, ogg_packet *op);
+
+static int   (*qvorbis_encode_init_vbr) (vorbis_info *vi, long channels, long rate, float base_quality);
+
+// dll pointers
+static dllhandle_t ogg_dll = NULL;
+static dllhandle_t vorbis_dll = NULL;
+static dllhandle_t vorbisenc_dll = NULL;
+
+// dll names to load
+const char* ogg_dllnames[] =
+{
+#if defined(WIN32)
+	"libogg-0.dll",
+	"libogg.dll",
+	"ogg.dll",
+#elif defined(MACOSX)
+	"libogg.dylib",
+#else
+	"libogg.so.0",
+	"libogg.so",
+#endif
+	NULL
+};
+
+const char* vorbis_dllnames[] =
+{
+#if defined(WIN32)
+	"libvorbis-0.dll",
+	"libvorbis.dll",
+	"vorbis.dll",
+#elif defined(MACOSX)
+	"libvorbis.dylib",
+#else
+	"libvorbis.so.0",
+	"libvorbis.so",
+#endif
+	NULL
+};
+
+const char* vorbisenc_dllnames[] =
+{
+#if defined(WIN32)
+	"libvorbisenc-2.dll",
+	"libvorbisenc.dll",
+	"vorbisenc.dll",
+#elif defined(MACOSX)
+	"libvorbisenc.dylib",
+#else
+	"libvorbisenc.so.2",
+	"libvorbisenc.so",
+#endif
+	NULL
+};
+
+// functions to import
+static dllfunction_t ogg_funcs[] =
+{
+	{"ogg_stream_init",				(void **) &qogg_stream_init},
+	{"ogg_stream_clear",			(void **) &qogg_stream_clear},
+	{"ogg_stream_packetin",			(void **) &qogg_stream_packetin},
+	{"ogg_stream_pageout",			(void **) &qogg_stream_pageout},
+	{"ogg_stream_flush",			(void **) &qogg_stream_flush},
+	{"ogg_page_eos",				(void **) &qogg_page_eos},
+	{NULL, NULL}
+};
+
+static dllfunction_t vorbis_funcs[] =
+{
+	{"vorbis_info_init",			(void **) &qvorbis_info_init},
+	{"vorbis_info_clear",			(void **) &qvorbis_info_clear},
+	{"vorbis_comment_init",			(void **) &qvorbis_comment_init},
+	{"vorbis_comment_clear",		(void **) &qvorbis_comment_clear},
+	{"vorbis_analysis_init",		(void **) &qvorbis_analysis_init},
+	{"vorbis_block_init",			(void **) &qvorbis_block_init},
+	{"vorbis_block_clear",			(void **) &qvorbis_block_clear},
+	{"vorbis_dsp_clear",			(void **) &qvorbis_dsp_clear},
+	{"vorbis_analysis_headerout",	(void **) &qvorbis_analysis_headerout},
+	{"vorbis_analysis_buffer",		(void **) &qvorbis_analysis_buffer},
+	{"vorbis_analysis_wrote",		(void **) &qvorbis_analysis_wrote},
+	{"vorbis_analysis_blockout",	(void **) &qvorbis_analysis_blockout},
+	{"vorbis_analysis",				(void **) &qvorbis_analysis},
+	{"vorbis_bitrate_addblock",		(void **) &qvorbis_bitrate_addblock},
+	{"vorbis_bitrate_flushpacket",	(void **) &qvorbis_bitrate_flushpacket},
+	{NULL, NULL}
+};
+
+static dllfunction_t vorbisenc_funcs[] =
+{
+	{"vorbis_encode_init_vbr",		(void **) &qvorbis_encode_init_vbr},
+	{NULL, NULL}
+};
+
+// samples are fed to encoder by this amount
+#define VORBIS_CHUNK 4096
+
+/*
+====================
+Vorbis_Encode
+
+Ogg Vorbis encoding
+====================
+*/
+
+static void Vorbis_WritePage(MemBuf_t *b, ogg_page *og)
+{
+	bwrite(b, og->header, og->header_len);
+	bwrite(b, og->body, og->body_len);
+}
+
+byte *Vorbis_Encode(short *samples, int numsamples, int channels, int rate, float quality, int *outsize)
+{
+	ogg_packet op, header, header_comm, header_code;
+	vorbis_dsp_state vd;
+	vorbis_comment vc;
+	ogg_stream_state os;
+	vorbis_block vb;
+	vorbis_info vi;
+	ogg_page og;
+	MemBuf_t *b;
+	float **buffer;
+	int i, c, n, pos;
+	bool eos;
+	byte *data;
+
+	if (!Vorbis_Enabled())
+		Error("Vorbis_Encode: libvorbis not enabled!");
+
+	qvorbis_info_init(&vi);
+	if (qvorbis_encode_init_vbr(&vi, channels, rate, max(0.0f, min(quality, 10.0f)) * 0.1f))
+	{
+		qvorbis_info_clear(&vi);
+		return NULL;
+	}
+	qvorbis_comment_init(&vc);
+	qvorbis_analysis_init(&vd, &vi);
+	qvorbis_block_init(&vd, &vb);
+
+	// stream serial number is made from contents, not random like in SoX,
+	// so same sound always produce same file
+	qogg_stream_init(&os, (int)crc32((unsigned char *)samples, numsamples * channels * sizeof(short)));
+
+	// headers go to their own pages
+	b = bcreate(numsamples * channels / 4 + 8192);
+	qvorbis_analysis_headerout(&vd, &vc, &header, &header_comm, &header_code);
+	qogg_stream_packetin(&os, &header);
+	qogg_stream_packetin(&os, &header_comm);
+	qogg_stream_packetin(&os, &header_code);
+	while(qogg_stream_flush(&os, &og))
+		Vorbis_WritePage(b, &og);
+
+	// encode, zero-length write marks end of stream
+	eos = false;
+	for (pos = 0; !eos; pos += n)
+	{
+		n = min(VORBIS_CHUNK, numsamples - pos);
+		if (n > 0)
+		{
+			buffer = qvorbis_analysis_buffer(&vd, n);
+			for (c = 0; c < channels; c++)
+				for (i = 0; i < n; i++)
+					buffer[c][i] = samples[(pos + i) * channels + c] * (1.0f / 32768.0f);
+		}
+		qvorbis_analysis_wrote(&vd, max(n, 0));
+		while(qvorbis_analysis_blockout(&vd, &vb) == 1)
+		{
+			qvorbis_analysis(&vb, NULL);
+			qvorbis_bitrate_addblock(&vb);
+			while(qvorbis_bitrate_flushpacket(&vd, &op))
+			{
+				qogg_stream_packetin(&os, &op);
+				while(qogg_stream_pageout(&os, &og))
+				{
+					Vorbis_WritePage(b, &og);
+					if (qogg_page_eos(&og))
+						eos = true;
+				}
+			}
+		}
+		// all blocks are out and no end of stream page was made
+		if (n <= 0 && !eos)
+		{
+			while(qogg_stream_flush(&os, &og))
+				Vorbis_WritePage(b, &og);
+			eos = true;
+		}
+	}
+
+	qogg_stream_clear(&os);
+	qvorbis_block_clear(&vb);
+	qvorbis_dsp_clear(&vd);
+	qvorbis_comment_clear(&vc);
+	qvorbis_info_clear(&vi);
+
+	*outsize = brelease(b, (void **)&data);
+	return data;
+}
+
+/*
+====================
+Vorbis_CloseLibrary
+
+Unload the libvorbis DLLs
+====================
+*/
+
+void Vorbis_CloseLibrary(void)
+{
+	UnloadDll(&vorbisenc_dll);
+	UnloadDll(&vorbis_dll);
+	UnloadDll(&ogg_dll);
+}
+
+/*
+====================
+Vorbis_OpenLibrary
+
+Try to load libogg, libvorbis and libvorbisenc, all of them are needed
+====================
+*/
+
+bool Vorbis_OpenLibrary(bool verbose)
+{
+	if (vorbisenc_dll)
+		return true;
+	if (!LoadDll(ogg_dllnames, &ogg_dll, ogg_funcs, verbose))
+		return false;
+	if (!LoadDll(vorbis_dllnames, &vorbis_dll, vorbis_funcs, verbose) || !LoadDll(vorbisenc_dllnames, &vorbisenc_dll, vorbisenc_funcs, verbose))
+	{
+		Vorbis_CloseLibrary();
+		return false;
+	}
+	return true;
+}
+
+/*
+====================
+Vorbis_Enabled
+
+See if libvorbis is available, library is loaded at startup so this is safe to call from any thread
+====================
+*/
+
+bool Vorbis_Enabled(void)
+{
+	return (vorbisenc_dll != 0);
+}
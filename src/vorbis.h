@@ -0,0 +1,35 @@
+////////////////////////////////////////////////////////////////
+//
+// Blood Pill - Ogg Vorbis encoding
+//
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+////////////////////////////////
+
+
+#ifndef __VORBIS_H__
+#define __VORBIS_H__
+
+// libvorbis is optional, it's loaded at startup like zlib
+void Vorbis_CloseLibrary(void);
+bool Vorbis_OpenLibrary(bool verbose);
+bool Vorbis_Enabled(void);
+
+// encodes interleaved 16-bit samples to Ogg Vorbis file, quality is 0-10 (like SoX -C)
+// output only depends on input, so it is the same for any number of threads
+byte *Vorbis_Encode(short *samples, int numsamples, int channels, int rate, float quality, int *outsize);
+
+#endif
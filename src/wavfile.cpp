@@ -0,0 +1,106 @@
+////////////////////////////////////////////////////////////////
+//
+// Blood Pill - RIFF WAVE writing
+//
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+////////////////////////////////
+
+
+#include "bloodpill.h"
+#include "wavfile.h"
+
+void WAV_WriteHeader(byte *header, int rate, int channels, unsigned int datasize)
+{
+	memcpy(header, "RIFF", 4);
+	WriteUInt(header + 4, 36 + datasize);
+	memcpy(header + 8, "WAVEfmt ", 8);
+	WriteUInt(header + 16, 16);
+	WriteUShort(header + 20, 1);
+	WriteUShort(header + 22, channels);
+	WriteUInt(header + 24, rate);
+	WriteUInt(header + 28, rate * channels * 2);
+	WriteUShort(header + 32, channels * 2);
+	WriteUShort(header + 34, 16);
+	memcpy(header + 36, "data", 4);
+	WriteUInt(header + 40, datasize);
+}
+
+wavwriter_t *WAV_Create(char *filename, int rate, int channels)
+{
+	wavwriter_t *wav;
+
+	wav = (wavwriter_t *)mem_alloc(sizeof(wavwriter_t));
+	wav->f = SafeOpen(filename, "wb");
+	wav->datasize = 0;
+	wav->rate = rate;
+	wav->channels = channels;
+	wav->buffered = 0;
+
+	// sizes are not known yet
+	WAV_WriteHeader(wav->buffer, rate, channels, 0);
+	SafeWrite(wav->f, wav->buffer, WAV_HEADER_SIZE);
+	return wav;
+}
+
+void WAV_Write(wavwriter_t *wav, short *samples, int numsamples)
+{
+	int i, n;
+
+	numsamples *= wav->channels;
+	while(numsamples > 0)
+	{
+		n = min(numsamples, (WAV_BUFFER_SIZE - wav->buffered) / 2);
+		for (i = 0; i < n; i++)
+		{
+			wav->buffer[wav->buffered + i*2] = samples[i] & 0xFF;
+			wav->buffer[wav->buffered + i*2 + 1] = (samples[i] >> 8) & 0xFF;
+		}
+		wav->buffered += n * 2;
+		samples += n;
+		numsamples -= n;
+		// flush full block
+		if (wav->buffered == WAV_BUFFER_SIZE)
+		{
+			SafeWrite(wav->f, wav->buffer, WAV_BUFFER_SIZE);
+			wav->datasize += WAV_BUFFER_SIZE;
+			wav->buffered = 0;
+		}
+	}
+}
+
+void WAV_Close(wavwriter_t *wav)
+{
+	byte header[WAV_HEADER_SIZE];
+
+	if (wav->buffered)
+	{
+		SafeWrite(wav->f, wav->buffer, wav->buffered);
+		wav->datasize += wav->buffered;
+	}
+
+	// back-patch header
+	WAV_WriteHeader(header, wav->rate, wav->channels, wav->datasize);
+	fseek(wav->f, 0, SEEK_SET);
+	SafeWrite(wav->f, header, WAV_HEADER_SIZE);
+	fclose(wav->f);
+	mem_free(wav);
+}
+
+void WAV_Sink(short *samples, int numsamples, void *wav)
+{
+	WAV_Write((wavwriter_t *)wav, samples, numsamples);
+}
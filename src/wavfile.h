@@ -0,0 +1,54 @@
+////////////////////////////////////////////////////////////////
+//
+// Blood Pill - RIFF WAVE writing
+//
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+////////////////////////////////
+
+
+#ifndef __WAVFILE__
+#define __WAVFILE__
+
+#define WAV_HEADER_SIZE		44
+#define WAV_BUFFER_SIZE		65536
+
+// decoders pass samples to sink by blocks as they are decoded
+typedef void (*pcmsink_t)(short *samples, int numsamples, void *sinkdata);
+
+// streaming 16-bit PCM RIFF WAVE writer
+// samples are written by fixed-size blocks, header sizes are patched when file is closed
+typedef struct
+{
+	FILE         *f;
+	unsigned int  datasize;
+	int           rate;
+	int           channels;
+	int           buffered;
+	byte          buffer[WAV_BUFFER_SIZE];
+}wavwriter_t;
+
+// fill 44-byte canonical header
+void WAV_WriteHeader(byte *header, int rate, int channels, unsigned int datasize);
+
+wavwriter_t *WAV_Create(char *filename, int rate, int channels);
+void WAV_Write(wavwriter_t *wav, short *samples, int numsamples);
+void WAV_Close(wavwriter_t *wav);
+
+// pcmsink_t for wavwriter_t
+void WAV_Sink(short *samples, int numsamples, void *wav);
+
+#endif